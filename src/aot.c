@@ -0,0 +1,213 @@
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "aot.h"
+#include "cpu.h"
+#include "hash.h"
+#include "log.h"
+
+/*
+ * Ahead of Time Cores
+ *
+ * A core has a function for each block of code aotc found in a ROM image.
+ * Blocks are kept by where they start in the image, as decoded instructions
+ * are (see cpu.c), so wherever control reaches the start of one, whatever
+ * bank it is in, the block runs in place of the interpreter. Code aotc did
+ * not find, code in RAM and code on hooked pages is left to the
+ * interpreter, which hands back on the next jump to a block. Blocks do what
+ * cpu_run() does, with the decoding done, and stop where it would, so a
+ * console runs the same with or without its core.
+ *
+ * A core is loaded once, however many consoles have the image plugged in,
+ * and unloaded with the last of them.
+ *
+ * Loading a core runs its code, so neither the directory nor the core may
+ * be anyone else's, or writable by anyone else.
+ */
+
+#define MAX_PATH 4096
+
+struct aot_t {
+	uint64_t hash;
+	void *handle;
+	/* By offset in the image, NULL where no block starts */
+	aot_fn_t *blocks;
+	int users;
+	struct aot_t *next;
+};
+
+static char core_dir[MAX_PATH];
+static aot_t *cores;
+static pthread_mutex_t cores_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Whether the file at path is the user's and no one else can write to it */
+static _Bool trusted(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return 0;
+	}
+	if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		log_warn("%s: Not yours alone, no core is loaded from it", path);
+		return 0;
+	}
+	return 1;
+}
+
+void aot_open(const char *dir) {
+	if (strlen(dir) >= MAX_PATH) {
+		log_warn("Core directory path too long, not using it: %s", dir);
+		return;
+	}
+	if (access(dir, F_OK) != 0) {
+		log_warn("No core directory %s", dir);
+		return;
+	}
+	if (!trusted(dir)) {
+		return;
+	}
+	strcpy(core_dir, dir);
+}
+
+/* Load the core for the image in emu, NULL if there is none or it is not
+ * for this image or this build */
+static aot_t *load(const emu_t *emu, uint64_t hash) {
+	char path[MAX_PATH];
+	if (snprintf(path, sizeof(path), "%s/%016" PRIx64 ".so", core_dir, hash) >= (int)sizeof(path) ||
+			access(path, F_OK) != 0 || !trusted(path)) {
+		return NULL;
+	}
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		log_warn("%s", dlerror());
+		return NULL;
+	}
+	const aot_core_t *core = dlsym(handle, "aot_core");
+	const char *problem = NULL;
+	if (!core) {
+		problem = "not a core";
+	}
+	else if (core->abi != AOT_ABI || core->emu_size != sizeof(emu_t)) {
+		problem = "built for another version of the emulator, run aotc again";
+	}
+	else if (core->hash != hash || core->rom_size != emu->cart_map.rom_size) {
+		problem = "built for another ROM";
+	}
+	if (problem) {
+		log_warn("%s: %s", path, problem);
+		dlclose(handle);
+		return NULL;
+	}
+
+	aot_t *aot = malloc(sizeof(*aot));
+	aot_fn_t *blocks = calloc(core->rom_size, sizeof(*blocks));
+	if (!aot || !blocks) {
+		log_fatal("aot_acquire(): Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < core->nblocks; ++i) {
+		if (core->blocks[i].offset < core->rom_size) {
+			blocks[core->blocks[i].offset] = core->blocks[i].run;
+		}
+	}
+	aot->hash = hash;
+	aot->handle = handle;
+	aot->blocks = blocks;
+	aot->users = 0;
+	log_trace("Loaded %s, %zu blocks", path, core->nblocks);
+	return aot;
+}
+
+aot_t *aot_acquire(emu_t *emu) {
+	if (!core_dir[0] || !emu->cart_map.decode) {
+		return NULL;
+	}
+	uint64_t hash = hash64(emu->mspace.rom, emu->mspace.rom_size, 0);
+	pthread_mutex_lock(&cores_lock);
+	aot_t *aot = cores;
+	while (aot && aot->hash != hash) {
+		aot = aot->next;
+	}
+	if (!aot) {
+		aot = load(emu, hash);
+		if (aot) {
+			aot->next = cores;
+			cores = aot;
+		}
+	}
+	if (aot) {
+		aot->users++;
+	}
+	pthread_mutex_unlock(&cores_lock);
+	return aot;
+}
+
+void aot_release(aot_t *aot) {
+	if (!aot) {
+		return;
+	}
+	pthread_mutex_lock(&cores_lock);
+	if (--aot->users == 0) {
+		aot_t **link = &cores;
+		while (*link != aot) {
+			link = &(*link)->next;
+		}
+		*link = aot->next;
+		dlclose(aot->handle);
+		free(aot->blocks);
+		free(aot);
+	}
+	pthread_mutex_unlock(&cores_lock);
+}
+
+/* The block starting at pc, NULL if there is none or pc is not in ROM or
+ * on a hooked page */
+static aot_fn_t block_at(const emu_t *emu, addr_t pc) {
+	const cart_map_t *map = &emu->cart_map;
+	if (!(pc & 0x1000)) {
+		return NULL;
+	}
+	int page = (pc & (CART_SIZE - 1)) / CART_PAGE;
+	if (!map->decoded[page]) {
+		return NULL;
+	}
+	return emu->aot->blocks[(map->decoded[page] - map->decode) + pc % CART_PAGE];
+}
+
+/* For the interpreter, see cpu_run_until() */
+static _Bool reaches_block(emu_t *emu, addr_t pc) {
+	return block_at(emu, pc) != NULL;
+}
+
+cycles_t aot_run(emu_t *emu, cycles_t budget) {
+	cpu_t *cpu = &emu->machine.cpu;
+	if (!cpu->running) {
+		return 0;
+	}
+	const cycles_t start = cpu->machine_cycles;
+	const cycles_t end = start + budget;
+	cpu->yield = 0;
+	while ((scycles_t)(end - cpu->machine_cycles) > 0) {
+		aot_fn_t run = block_at(emu, cpu->PC);
+		if (run) {
+			cycles_t before = cpu->machine_cycles;
+			run(emu, end);
+			if (cpu->yield) {
+				break;
+			}
+			/* Unless its first instruction was not switched in whole */
+			if (cpu->machine_cycles != before) {
+				continue;
+			}
+		}
+		cpu_run_until(emu, end - cpu->machine_cycles, reaches_block);
+		if (cpu->yield || !cpu->running) {
+			break;
+		}
+	}
+	return cpu->machine_cycles - start;
+}
@@ -0,0 +1,65 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include "emu.h"
+
+/* Cores compiled ahead of time from a ROM image by aotc. A core is a shared
+ * object with a function for each block of code found in the image. It is
+ * loaded for the image with its hash, and calls back into the emulator for
+ * memory, so a program loading cores must export its symbols (-rdynamic)
+ */
+
+/* Changed whenever what cores are built from changes: emu_t, cpu_ops.h or
+ * the structures below. Cores built for another one are not loaded
+ */
+#define AOT_ABI 3
+
+/* Runs a block of code in emu, with the registers in machine.cpu, until
+ * control leaves it or the cycle counter reaches end, and leaves the
+ * registers there
+ */
+typedef void (*aot_fn_t)(emu_t *emu, cycles_t end);
+
+/* The block of code at offset in the image */
+typedef struct aot_block_t {
+	uint32_t offset;
+	aot_fn_t run;
+} aot_block_t;
+
+/* What a core exports, as aot_core */
+typedef struct aot_core_t {
+	int abi;
+	size_t emu_size;
+	/* hash64() of the image file, and the size of the image as mapped */
+	uint64_t hash;
+	size_t rom_size;
+	size_t nblocks;
+	const aot_block_t *blocks;
+} aot_core_t;
+
+/* A loaded core, shared by the consoles with the same image plugged in */
+typedef struct aot_t aot_t;
+
+/* Load cores from dir, where aotc's output is put under the hash of the
+ * image: <hash>.so. Without a directory no core is loaded, nor from a
+ * directory or a file that is not the user's or that others can write to
+ */
+void aot_open(const char *dir);
+
+/* The core for the cartridge plugged into emu, NULL if there is none */
+aot_t *aot_acquire(emu_t *emu);
+/* Done with a core from aot_acquire() */
+void aot_release(aot_t *aot);
+
+/* Run as cpu_run() would, through the core's blocks wherever there is one */
+cycles_t aot_run(emu_t *emu, cycles_t budget);
+
+/* For the blocks: whether a shows the part of the image at offset */
+static inline _Bool aot_mapped(const emu_t *emu, addr_t a, size_t offset) {
+	const cart_map_t *map = &emu->cart_map;
+	return (a & 0x1000) &&
+		map->decoded[(a & (CART_SIZE - 1)) / CART_PAGE] == map->decode + (offset - offset % CART_PAGE);
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "aot.h"
+#include "pia.h"
+#include "tia.h"
+#include "log.h"
+#include "test_rom.h"
+#ifdef ENABLE_JIT
+#include "jit.h"
+#endif
+
+/*
+ * Usage: aot_test aotc
+ *
+ * Compiles the test ROM to a core with aotc, then checks that a console
+ * running through the core runs as one with the interpreter alone: after
+ * every frame the whole machine state and the picture have to be the same.
+ * The controls change as the frames go, the fire buttons included, so
+ * every path through the kernel is taken, decimal mode and all.
+ */
+
+#define NFRAMES 300
+
+static char dir[] = "/tmp/a26_test_coresXXXXXX";
+
+static uint16_t action(int frame) {
+	uint32_t h = (uint32_t)(frame / 8 + 1) * 2654435761u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995;
+	h ^= h >> 15;
+	return h & 0x03ff;
+}
+
+static void set_controls(emu_t *emu, uint16_t action) {
+	pia_set_joysticks(emu, action & 0xff);
+	tia_set_fire(emu, action >> 8);
+}
+
+/* Run aotc on rom, with the core going to dir */
+static _Bool run_aotc(const char *aotc, char *rom) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(aotc, aotc, "--romdb", "/dev/null", rom, dir, (char *)NULL);
+		printf("%s: %s\n", aotc, strerror(errno));
+		_exit(127);
+	}
+	int status;
+	return pid > 0 && waitpid(pid, &status, 0) == pid &&
+		WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Remove the core and the C it was built from */
+static void remove_cores() {
+	DIR *d = opendir(dir);
+	if (d) {
+		char path[sizeof(dir) + 256];
+		struct dirent *e;
+		while ((e = readdir(d)) != NULL) {
+			if (e->d_name[0] != '.') {
+				snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+				unlink(path);
+			}
+		}
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s aotc\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	log_set_quiet(1);
+	char *rom = test_rom_file();
+	/* Cores others may write to are not loaded */
+	umask(022);
+	if (!mkdtemp(dir)) {
+		printf("Could not make a directory for the core\n");
+		return EXIT_FAILURE;
+	}
+	atexit(remove_cores);
+	if (!run_aotc(argv[1], rom)) {
+		printf("aotc failed\n");
+		return EXIT_FAILURE;
+	}
+
+	emu_t *want = emu_new(rom, &null_backend);
+#ifdef ENABLE_JIT
+	jit_release(want->jit);
+	want->jit = NULL;
+#endif
+	aot_open(dir);
+	emu_t *got = emu_new(rom, &null_backend);
+	if (!got->aot) {
+		printf("The core was not loaded\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t size = emu_state_size(want);
+	byte_t *want_state = malloc(size);
+	byte_t *got_state = malloc(size);
+	int errors = 0;
+	for (int f = 0; f < NFRAMES; ++f) {
+		set_controls(want, action(f));
+		set_controls(got, action(f));
+		emu_step_frame(want);
+		emu_step_frame(got);
+		emu_save(want, want_state);
+		emu_save(got, got_state);
+		if ((memcmp(want_state, got_state, size) ||
+					memcmp(tia_frame(want), tia_frame(got), VISIBLE_WIDTH * VISIBLE_HEIGHT)) &&
+				errors++ == 0) {
+			printf("The core differs at frame %d\n", f);
+		}
+	}
+
+	emu_free(want);
+	emu_free(got);
+	free(want_state);
+	free(got_state);
+	printf("%d frames, %d mismatches\n", NFRAMES, errors);
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,558 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "aot.h"
+#include "cart.h"
+#include "cpu.h"
+#include "cpu_ops.h"
+#include "emu.h"
+#include "hash.h"
+#include "log.h"
+#include "romdb.h"
+
+/*
+ * Ahead of Time Compiler
+ *
+ * Usage: aotc [--romdb file] rom [dir]
+ *
+ * Finds the code in a ROM image, writes it out as C, a function for each
+ * block, and compiles that to a core the emulator loads for the image (see
+ * aot.h). Both go to dir, the current directory by default, named after the
+ * hash of the image.
+ *
+ * Code is found by recursive descent, from the reset vector of each bank.
+ * Jumps, calls and branches lead to more code, in the same bank if they stay
+ * in the part of the cartridge space that switches as one, or in any bank
+ * that may be switched in there if not. After an instruction that may
+ * switch banks the code that follows is looked for in every bank. Targets
+ * only known as the code runs, of indirect jumps and returns, are not
+ * followed: the interpreter runs that code, until it jumps to a block.
+ *
+ * A block is made of the statements cpu_run() executes for its
+ * instructions, taken from cpu_ops.h, with the decoding done. It runs until
+ * an unconditional jump, branches back to its start if one jumps there, and
+ * leaves as soon as a branch is taken elsewhere. It checks that its pages
+ * are still switched in when it reaches a new one, and after any access
+ * that may have switched banks. So a block found in the wrong bank, or not
+ * code at all, never runs, and finding too much costs nothing but space.
+ */
+
+/* Instructions in a block, at most */
+#define MAX_INSTS 64
+/* Banks that may show in a part of the cartridge space, at most (512K 3F) */
+#define MAX_BANKS 256
+
+#define MAX_PATH 4096
+
+/* Where the headers the cores are built with are */
+#ifndef AOTC_INCLUDE_DIR
+#define AOTC_INCLUDE_DIR "."
+#endif
+
+/* What cpu_run() does for each opcode, NULL for vacant ones */
+#define TEXT(opcode, statements) [opcode] = #statements,
+static const char *const op_text[256] = { CPU_OPS(TEXT) };
+
+/* A part of the cartridge space that switches as one: where it is and the
+ * offsets in the image of what may show there
+ */
+typedef struct slot_t {
+	addr_t start;
+	addr_t size;
+	int n;
+	size_t offsets[MAX_BANKS];
+} slot_t;
+
+typedef struct insn_t {
+	size_t offset;
+	addr_t addr;		/* In the cartridge space, 0x000-0xfff */
+	byte_t opcode;
+	addr_t operand;
+	int bytes;
+} insn_t;
+
+typedef struct image_t {
+	/* A console with the image plugged in, as powered up */
+	emu_t *emu;
+	const byte_t *rom;
+	size_t size;
+	enum mapper_t mapper;
+	/* By offset: where a block starts was found at, -1 if none does */
+	int32_t *leader;
+	/* By offset: the slots it was looked at in, a bit each */
+	byte_t *seen;
+	/* Offsets and addresses still to look at */
+	size_t *todo;
+	size_t ntodo;
+	size_t todo_size;
+} image_t;
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--romdb file] rom [dir]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void out_of_memory() {
+	log_fatal("aotc: Out of memory");
+	exit(EXIT_FAILURE);
+}
+
+/* The slot a is in, see map_banks() in cart.c */
+static slot_t slot_of(const image_t *im, addr_t a) {
+	slot_t s = { 0, CART_SIZE, 0, { 0 } };
+	size_t bank_size = CART_SIZE;
+	size_t nbanks = 1;
+	switch (im->mapper) {
+		case MAPPER_NONE:
+			break;
+		case MAPPER_F8:
+		case MAPPER_F6:
+		case MAPPER_F4:
+		case MAPPER_FA:
+		case MAPPER_FE:
+			nbanks = im->size / CART_SIZE;
+			break;
+		case MAPPER_E0:
+			s.start = a & 0x0c00;
+			s.size = bank_size = 0x0400;
+			if (s.start == 0x0c00) {
+				s.n = 1;
+				s.offsets[0] = 7 * 0x0400;
+				return s;
+			}
+			nbanks = 8;
+			break;
+		case MAPPER_E7:
+			if (a >= 0x0a00) {
+				s.start = 0x0a00;
+				s.size = 0x0600;
+				s.n = 1;
+				s.offsets[0] = im->size - 0x0600;
+				return s;
+			}
+			s.size = bank_size = 0x0800;
+			if (a >= 0x0800) {
+				/* RAM */
+				s.start = 0x0800;
+				return s;
+			}
+			/* Bank 7 is RAM */
+			nbanks = 7;
+			break;
+		case MAPPER_3F:
+			s.size = bank_size = 0x0800;
+			if (a >= 0x0800) {
+				s.start = 0x0800;
+				s.n = 1;
+				s.offsets[0] = im->size - 0x0800;
+				return s;
+			}
+			nbanks = im->size / 0x0800;
+			break;
+	}
+	for (size_t bank = 0; bank < nbanks && bank < MAX_BANKS; ++bank) {
+		s.offsets[s.n++] = bank * bank_size;
+	}
+	return s;
+}
+
+/* Whether what is at a at power up is ROM, read without a hook */
+static _Bool is_rom(const image_t *im, addr_t a) {
+	return im->emu->cart_map.decoded[a / CART_PAGE] != NULL;
+}
+
+/* Look for code at offset, where it shows at a */
+static void queue(image_t *im, size_t offset, addr_t a) {
+	if (offset >= im->size || a >= CART_SIZE || !is_rom(im, a)) {
+		return;
+	}
+	if (im->ntodo + 2 > im->todo_size) {
+		im->todo_size = im->todo_size ? 2 * im->todo_size : 1024;
+		im->todo = realloc(im->todo, im->todo_size * sizeof(*im->todo));
+		if (!im->todo) {
+			out_of_memory();
+		}
+	}
+	im->todo[im->ntodo++] = offset;
+	im->todo[im->ntodo++] = a;
+}
+
+/* Control may go from the code at offset, at from, to to. In the same bank
+ * if it stays in the slot and same_bank is set, in any bank otherwise
+ */
+static void target(image_t *im, size_t offset, addr_t from, addr_t to, _Bool same_bank) {
+	slot_t fs = slot_of(im, from);
+	slot_t ts = slot_of(im, to);
+	if (same_bank && fs.start == ts.start) {
+		queue(im, offset - (from - fs.start) + (to - ts.start), to);
+		return;
+	}
+	for (int i = 0; i < ts.n; ++i) {
+		queue(im, ts.offsets[i] + (to - ts.start), to);
+	}
+}
+
+/* Control may go to address, from the code at offset, at from */
+static void jump(image_t *im, size_t offset, addr_t from, addr_t address) {
+	if (address & 0x1000) {
+		target(im, offset, from, address & (CART_SIZE - 1), 1);
+	}
+}
+
+/* The instructions of the block at offset, where it shows at a. Returns
+ * how many
+ */
+static int block_of(const image_t *im, size_t offset, addr_t a, insn_t *insts) {
+	slot_t s = slot_of(im, a);
+	int n = 0;
+	while (n < MAX_INSTS) {
+		byte_t opcode = im->rom[offset];
+		int bytes = inst_bytes(opcode);
+		if (!op_text[opcode] || offset + bytes > im->size ||
+				a + bytes > s.start + s.size || !is_rom(im, a) ||
+				!is_rom(im, a + bytes - 1)) {
+			break;
+		}
+		insn_t *in = &insts[n++];
+		in->offset = offset;
+		in->addr = a;
+		in->opcode = opcode;
+		in->operand = 0;
+		for (int i = 1; i < bytes; ++i) {
+			in->operand |= im->rom[offset + i] << (8 * (i - 1));
+		}
+		in->bytes = bytes;
+		if (strstr(op_text[opcode], "JUMPED()")) {
+			break;
+		}
+		offset += bytes;
+		a += bytes;
+	}
+	return n;
+}
+
+static _Bool starts_with(const char *s, const char *prefix) {
+	return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* Whether the instruction may switch banks. Only hooked pages have
+ * hotspots, and 3F cartridges switch on writes to 0x00-0x3f
+ */
+static _Bool may_switch(const image_t *im, const insn_t *in) {
+	const char *text = op_text[in->opcode];
+	_Bool writes = strstr(text, "WRITE(") || strstr(text, "RMW(");
+	if (!writes && !strstr(text, "READ(")) {
+		/* Nothing but the stack, which is RAM or the TIA */
+		return 0;
+	}
+	if (starts_with(text, "INX()") || starts_with(text, "INY")) {
+		return 1;
+	}
+	/* Where the access may go */
+	unsigned int first = in->operand;
+	unsigned int last = in->operand;
+	if (starts_with(text, "ZPX()") || starts_with(text, "ZPY()")) {
+		first = 0x00;
+		last = 0xff;
+	}
+	else if (starts_with(text, "ABX") || starts_with(text, "ABY")) {
+		last = in->operand + 0xff;
+	}
+	else if (!starts_with(text, "ZP()") && !starts_with(text, "ABS()")) {
+		/* JMP (ind) and BRK read pointers, and end the block anyway */
+		return 1;
+	}
+	for (unsigned int ea = first; ea <= last; ++ea) {
+		addr_t bus = ea & ADDR_MASK;
+		if (im->mapper == MAPPER_3F ? writes && bus < 0x40 :
+				(bus & 0x1000) && im->emu->cart_map.hooked[(bus & (CART_SIZE - 1)) / CART_PAGE]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Follow the code at offset, where it shows at a */
+static void follow(image_t *im, size_t offset, addr_t a) {
+	int key = slot_of(im, a).start / 0x0400;
+	if (im->seen[offset] & (1 << key)) {
+		return;
+	}
+	im->seen[offset] |= 1 << key;
+	if (im->leader[offset] < 0) {
+		im->leader[offset] = a;
+	}
+	insn_t insts[MAX_INSTS];
+	int n = block_of(im, offset, a, insts);
+	for (int i = 0; i < n; ++i) {
+		const insn_t *in = &insts[i];
+		addr_t next = in->addr + in->bytes;
+		if (starts_with(op_text[in->opcode], "BRANCH(")) {
+			jump(im, in->offset, in->addr,
+					(0x1000 | next) + (((in->operand & 0xff) ^ 0x80) - 0x80));
+		}
+		else if (in->opcode == 0x4c) {
+			jump(im, in->offset, in->addr, in->operand);
+		}
+		else if (in->opcode == 0x20) {
+			jump(im, in->offset, in->addr, in->operand);
+			/* Where it returns to */
+			target(im, in->offset, in->addr, next, 1);
+		}
+		if (may_switch(im, in)) {
+			target(im, in->offset, in->addr, next, 0);
+		}
+	}
+	/* Code the block runs on into, if it stopped short of a jump */
+	if (n > 0 && !strstr(op_text[insts[n - 1].opcode], "JUMPED()")) {
+		const insn_t *last = &insts[n - 1];
+		target(im, last->offset, last->addr, last->addr + last->bytes, 1);
+	}
+}
+
+/* Follow the code a vector at the end of the space points at, in each bank */
+static void vector(image_t *im, addr_t a) {
+	slot_t s = slot_of(im, a);
+	for (int i = 0; i < s.n; ++i) {
+		size_t offset = s.offsets[i] + (a - s.start);
+		addr_t address = im->rom[offset] | im->rom[offset + 1] << 8;
+		/* As load_cartridge() has it */
+		if (!(address & 0x1000)) {
+			address = CARMEM_START;
+		}
+		target(im, offset, a, address & (CART_SIZE - 1), 1);
+	}
+}
+
+static void find_code(image_t *im) {
+	vector(im, 0x0ffc);
+	vector(im, 0x0ffe);
+	while (im->ntodo) {
+		addr_t a = im->todo[--im->ntodo];
+		size_t offset = im->todo[--im->ntodo];
+		follow(im, offset, a);
+	}
+}
+
+static void emit_block(FILE *fp, const image_t *im, size_t offset) {
+	insn_t insts[MAX_INSTS];
+	int n = block_of(im, offset, im->leader[offset], insts);
+	_Bool jumps = 0;
+	_Bool switches = 0;
+	for (int i = 0; i < n; ++i) {
+		jumps |= strstr(op_text[insts[i].opcode], "JUMPED()") || strstr(op_text[insts[i].opcode], "BRANCH(");
+		switches |= may_switch(im, &insts[i]);
+	}
+
+	fprintf(fp, "static void b_%05zx(emu_t *emu, cycles_t end) {\n", offset);
+	fprintf(fp, "\tcpu_t *cpu = &emu->machine.cpu;\n");
+	fprintf(fp, "\tbyte_t a = cpu->A;\n");
+	fprintf(fp, "\tbyte_t x = cpu->X;\n");
+	fprintf(fp, "\tbyte_t y = cpu->Y;\n");
+	fprintf(fp, "\tbyte_t s = cpu->S;\n");
+	fprintf(fp, "\tbyte_t p, n, z, c;\n");
+	fprintf(fp, "\tSET_FLAGS(cpu->P);\n");
+	fprintf(fp, "\taddr_t pc = cpu->PC;\n");
+	if (jumps) {
+		fprintf(fp, "\tconst addr_t pc0 = pc;\n");
+	}
+	fprintf(fp, "\taddr_t operand;\n");
+	fprintf(fp, "\taddr_t ea = 0;\n");
+	fprintf(fp, "\tcycles_t clk = cpu->machine_cycles;\n");
+	fprintf(fp, "\n");
+	if (jumps) {
+		fprintf(fp, "top:\n");
+	}
+	/* The page of the image known to be switched in */
+	ptrdiff_t verified = offset / CART_PAGE;
+	for (int i = 0; i < n; ++i) {
+		const insn_t *in = &insts[i];
+		ptrdiff_t first = in->offset / CART_PAGE;
+		ptrdiff_t last = (in->offset + in->bytes - 1) / CART_PAGE;
+		fprintf(fp, "\t/* %05zx: %s */\n", in->offset, inst_name(in->opcode));
+		fprintf(fp, "\tif ((scycles_t)(end - clk) <= 0) goto out;\n");
+		if (first != verified) {
+			fprintf(fp, "\tif (!aot_mapped(emu, pc, 0x%05zx)) goto out;\n", in->offset);
+		}
+		if (last != first) {
+			fprintf(fp, "\tif (!aot_mapped(emu, pc + %d, 0x%05zx)) goto out;\n",
+					in->bytes - 1, in->offset + in->bytes - 1);
+		}
+		verified = may_switch(im, in) ? -1 : last;
+		fprintf(fp, "\toperand = 0x%04x; pc += %d; clk += %d;\n",
+				in->operand, in->bytes, inst_cycles(in->opcode));
+		fprintf(fp, "\t%s;\n", op_text[in->opcode]);
+	}
+	if (jumps) {
+		fprintf(fp, "\tgoto out;\n");
+		fprintf(fp, "jumped:\n");
+		if (switches) {
+			fprintf(fp, "\tif (pc == pc0 && aot_mapped(emu, pc, 0x%05zx)) goto top;\n", offset);
+		}
+		else {
+			fprintf(fp, "\tif (pc == pc0) goto top;\n");
+		}
+	}
+	fprintf(fp, "out:\n");
+	fprintf(fp, "\tcpu->A = a;\n");
+	fprintf(fp, "\tcpu->X = x;\n");
+	fprintf(fp, "\tcpu->Y = y;\n");
+	fprintf(fp, "\tcpu->S = 0x0100 | s;\n");
+	fprintf(fp, "\tcpu->P = FLAGS();\n");
+	fprintf(fp, "\tcpu->PC = pc;\n");
+	fprintf(fp, "\tcpu->machine_cycles = clk;\n");
+	fprintf(fp, "\t(void)operand;\n");
+	fprintf(fp, "\t(void)ea;\n");
+	fprintf(fp, "}\n\n");
+}
+
+/* Whether there is a block at offset */
+static _Bool has_block(const image_t *im, size_t offset) {
+	insn_t insts[MAX_INSTS];
+	return im->leader[offset] >= 0 && block_of(im, offset, im->leader[offset], insts) > 0;
+}
+
+/* Write the core for the image, for a file hashing to hash */
+static size_t emit(FILE *fp, const image_t *im, const char *name, uint64_t hash) {
+	fprintf(fp, "/* Generated by aotc from %s, see aot.h */\n\n", name);
+	fprintf(fp, "#include \"aot.h\"\n");
+	fprintf(fp, "#include \"cpu_ops.h\"\n\n");
+	fprintf(fp, "#define JUMPED() goto jumped\n\n");
+	size_t nblocks = 0;
+	for (size_t offset = 0; offset < im->size; ++offset) {
+		if (has_block(im, offset)) {
+			emit_block(fp, im, offset);
+			nblocks++;
+		}
+	}
+	fprintf(fp, "static const aot_block_t blocks[] = {\n");
+	for (size_t offset = 0; offset < im->size; ++offset) {
+		if (has_block(im, offset)) {
+			fprintf(fp, "\t{ 0x%05zx, b_%05zx },\n", offset, offset);
+		}
+	}
+	fprintf(fp, "};\n\n");
+	fprintf(fp, "const aot_core_t aot_core = {\n");
+	fprintf(fp, "\tAOT_ABI, sizeof(emu_t), UINT64_C(0x%016" PRIx64 "), %zu, %zu, blocks\n",
+			hash, im->size, nblocks);
+	fprintf(fp, "};\n");
+	return nblocks;
+}
+
+/* Compile the C at c_path to a shared object at so_path */
+static _Bool compile(const char *c_path, const char *so_path) {
+	const char *cc = getenv("CC");
+	const char *argv[] = {
+		cc && cc[0] ? cc : "cc", "-O2", "-fPIC", "-shared",
+#ifdef ENABLE_JIT
+		/* It changes emu_t */
+		"-DENABLE_JIT",
+#endif
+		"-I", AOTC_INCLUDE_DIR, "-o", so_path, c_path, NULL
+	};
+	pid_t pid = fork();
+	if (pid == 0) {
+		execvp(argv[0], (char *const *)argv);
+		log_fatal("%s: %s", argv[0], strerror(errno));
+		_exit(127);
+	}
+	int status;
+	if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+		log_fatal("aotc: Could not run %s: %s", argv[0], strerror(errno));
+		return 0;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+	char *rom = NULL;
+	const char *dir = ".";
+	const char *romdb = NULL;
+	int nargs = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--romdb") == 0 && i + 1 < argc) {
+			romdb = argv[++i];
+		}
+		else if (nargs == 0) {
+			rom = argv[i];
+			nargs++;
+		}
+		else if (nargs == 1) {
+			dir = argv[i];
+			nargs++;
+		}
+		else {
+			usage(argv[0]);
+		}
+	}
+	if (rom == NULL) {
+		usage(argv[0]);
+	}
+	/* Identify the image as the emulator does */
+	char buf[MAX_PATH];
+	const char *home = getenv("HOME");
+	if (romdb == NULL && home != NULL) {
+		snprintf(buf, sizeof(buf), "%s/.a26romdb", home);
+		romdb = buf;
+	}
+	if (romdb != NULL) {
+		romdb_open(romdb);
+	}
+
+	image_t im;
+	memset(&im, 0, sizeof(im));
+	im.emu = emu_new(rom, &null_backend);
+	im.rom = im.emu->cart_map.rom;
+	im.size = im.emu->cart_map.rom_size;
+	im.mapper = im.emu->machine.cart.type.mapper;
+	if (im.mapper == MAPPER_FE) {
+		log_fatal("%s: Activision (FE) cartridges switch banks as they call, "
+				"there is nothing to compile", rom);
+		exit(EXIT_FAILURE);
+	}
+	im.leader = malloc(im.size * sizeof(*im.leader));
+	im.seen = calloc(im.size, 1);
+	if (!im.leader || !im.seen) {
+		out_of_memory();
+	}
+	for (size_t i = 0; i < im.size; ++i) {
+		im.leader[i] = -1;
+	}
+	find_code(&im);
+
+	uint64_t hash = hash64(im.emu->mspace.rom, im.emu->mspace.rom_size, 0);
+	char c_path[MAX_PATH];
+	char so_path[MAX_PATH];
+	char tmp_path[MAX_PATH];
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s/%016" PRIx64 ".so.tmp", dir, hash) >= (int)sizeof(tmp_path)) {
+		log_fatal("aotc: Path too long: %s", dir);
+		exit(EXIT_FAILURE);
+	}
+	snprintf(c_path, sizeof(c_path), "%s/%016" PRIx64 ".c", dir, hash);
+	snprintf(so_path, sizeof(so_path), "%s/%016" PRIx64 ".so", dir, hash);
+	FILE *fp = fopen(c_path, "w");
+	if (!fp) {
+		log_fatal("%s: %s", c_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	size_t nblocks = emit(fp, &im, rom, hash);
+	if (fclose(fp) != 0) {
+		log_fatal("%s: %s", c_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	/* Consoles starting meanwhile never see half a core */
+	if (!compile(c_path, tmp_path) || rename(tmp_path, so_path) != 0) {
+		log_fatal("aotc: Could not build %s", so_path);
+		exit(EXIT_FAILURE);
+	}
+	printf("%s: %zu blocks in %s\n", rom, nblocks, so_path);
+	emu_free(im.emu);
+	free(im.leader);
+	free(im.seen);
+	free(im.todo);
+	return 0;
+}
@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "cpu.h"
+#include "emu.h"
+#include "lockstep.h"
+#include "log.h"
+#include "pia.h"
+#include "tia.h"
+
+/*
+ * Batches
+ *
+ * The consoles of a batch are split into one contiguous slice per thread.
+ * The threads are started once, by batch_new(), and wait for a step in
+ * between: batch_step() publishes the step, wakes them up, joins in as
+ * worker 0 and waits for the others to finish. Nothing is allocated and
+ * nothing is locked while a step runs.
+ *
+ * Consoles do not all take as long to run a frame, so a worker that is
+ * done with its slice steals consoles from the others. Each worker keeps
+ * what is left of its slice as a deque of console indices: it takes from
+ * the front, thieves take from the back. Both ends are in one atomic word,
+ * so taking a console is a single compare and swap.
+ *
+ * Each worker creates its own consoles, which puts them in memory close to
+ * it as long as it stays put. With BATCH_PIN_THREADS every worker stays on
+ * one CPU. BATCH_NUMA pins them as well and has them steal from workers on
+ * the same node before going further.
+ *
+ * With BATCH_LOCKSTEP the work is handed out LOCKSTEP_LANES consoles at a
+ * time, which are run together by the lockstep interpreter.
+ *
+ * All consoles start out in the same power-on state, which is saved once
+ * and restored whenever an episode is over.
+ */
+
+#define CACHE_LINE 64
+#define MAX_NODES 64
+
+typedef struct worker_t {
+	/* What is left of the slice, in units: front in the low half, back in
+	 * the high */
+	_Alignas(CACHE_LINE) _Atomic uint64_t deque;
+	batch_t *batch;
+	int first, last;
+	int cpu;		/* -1 if not pinned */
+	int node;
+	/* The other workers, in the order to steal from them */
+	int *victims;
+	pthread_t thread;
+} worker_t;
+
+struct batch_t {
+	int n;
+	emu_t **emus;
+	/* Consoles handed out at a time */
+	int unit;
+	reward_fn_t reward;
+	byte_t *power_on;
+	int flags;
+	/* Only while the workers create their consoles */
+	char *rom;
+
+	int nthreads;
+	worker_t *workers;
+	/* Worker 0 is the caller's thread, the CPUs it had before it was pinned */
+	cpu_set_t caller_cpus;
+	_Bool caller_pinned;
+	pthread_mutex_t lock;
+	pthread_cond_t go;
+	pthread_cond_t finished;
+	/* Bumped for each step, a worker runs once for each value */
+	unsigned long step;
+	int running;
+	int starting;
+	_Bool quit;
+
+	/* The step being run */
+	const uint16_t *actions;
+	int frames;
+	byte_t *obs;
+	int32_t *rewards;
+	_Bool *dones;
+};
+
+static uint64_t deque_pack(uint32_t front, uint32_t back) {
+	return (uint64_t)back << 32 | front;
+}
+
+/* Take a console from the front of the deque, -1 if it is empty */
+static int deque_take(worker_t *w) {
+	uint64_t d = atomic_load(&w->deque);
+	for (;;) {
+		uint32_t front = d, back = d >> 32;
+		if (front >= back) {
+			return -1;
+		}
+		if (atomic_compare_exchange_weak(&w->deque, &d, deque_pack(front + 1, back))) {
+			return front;
+		}
+	}
+}
+
+/* Take a console from the back of the deque, -1 if it is empty */
+static int deque_steal(worker_t *w) {
+	uint64_t d = atomic_load(&w->deque);
+	for (;;) {
+		uint32_t front = d, back = d >> 32;
+		if (front >= back) {
+			return -1;
+		}
+		if (atomic_compare_exchange_weak(&w->deque, &d, deque_pack(front, back - 1))) {
+			return back - 1;
+		}
+	}
+}
+
+/* Hand the results of console i to the caller */
+static void finish_console(batch_t *batch, int i, int32_t reward, _Bool done) {
+	if (batch->obs) {
+		memcpy(batch->obs + (size_t)i * BATCH_OBS_SIZE, tia_frame(batch->emus[i]), BATCH_OBS_SIZE);
+	}
+	if (batch->rewards) {
+		batch->rewards[i] = reward;
+	}
+	if (batch->dones) {
+		batch->dones[i] = done;
+	}
+	if (done) {
+		emu_restore(batch->emus[i], batch->power_on);
+	}
+}
+
+/* Hold the controls in console i's action for the step */
+static void apply_action(batch_t *batch, int i) {
+	uint16_t action = batch->actions ? batch->actions[i] : 0;
+	pia_set_joysticks(batch->emus[i], action & 0xff);
+	tia_set_fire(batch->emus[i], action >> 8);
+}
+
+static void step_console(batch_t *batch, int i) {
+	emu_t *emu = batch->emus[i];
+	int32_t reward = 0;
+	_Bool done = 0;
+	apply_action(batch, i);
+	for (int f = 0; f < batch->frames && !done; ++f) {
+		emu_step_frame(emu);
+		if (batch->reward) {
+			reward += batch->reward(emu, &done);
+		}
+		done |= !cpu_fetch_status(emu);
+	}
+	finish_console(batch, i, reward, done);
+}
+
+/* Consoles first to last, at most LOCKSTEP_LANES of them, together */
+static void step_lockstep(batch_t *batch, int first, int last) {
+	int32_t reward[LOCKSTEP_LANES] = { 0 };
+	_Bool done[LOCKSTEP_LANES] = { 0 };
+	for (int i = first; i < last; ++i) {
+		apply_action(batch, i);
+	}
+	for (int f = 0; f < batch->frames; ++f) {
+		emu_t *run[LOCKSTEP_LANES];
+		int k = 0;
+		for (int i = first; i < last; ++i) {
+			if (!done[i - first]) {
+				run[k++] = batch->emus[i];
+			}
+		}
+		if (k == 0) {
+			break;
+		}
+		lockstep_step_frame(run, k);
+		for (int i = first; i < last; ++i) {
+			if (done[i - first]) {
+				continue;
+			}
+			if (batch->reward) {
+				reward[i - first] += batch->reward(batch->emus[i], &done[i - first]);
+			}
+			done[i - first] |= !cpu_fetch_status(batch->emus[i]);
+		}
+	}
+	for (int i = first; i < last; ++i) {
+		finish_console(batch, i, reward[i - first], done[i - first]);
+	}
+}
+
+static void step_unit(batch_t *batch, int u) {
+	if (batch->unit == 1) {
+		step_console(batch, u);
+		return;
+	}
+	int first = u * batch->unit;
+	int last = first + batch->unit < batch->n ? first + batch->unit : batch->n;
+	step_lockstep(batch, first, last);
+}
+
+/* Run the worker's own consoles, then whatever can be stolen */
+static void run_step(worker_t *w) {
+	batch_t *batch = w->batch;
+	int i;
+	while ((i = deque_take(w)) >= 0) {
+		step_unit(batch, i);
+	}
+	for (int v = 0; v < batch->nthreads - 1; ++v) {
+		worker_t *victim = &batch->workers[w->victims[v]];
+		while ((i = deque_steal(victim)) >= 0) {
+			step_unit(batch, i);
+		}
+	}
+}
+
+static void pin(worker_t *w) {
+	if (w->cpu < 0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		log_warn("Could not pin a batch thread to CPU %d", w->cpu);
+	}
+}
+
+/* Pin the worker and create its consoles, from its own thread so that
+ * they are allocated close to it. Creating a console is not thread safe */
+static void start_worker(worker_t *w) {
+	batch_t *batch = w->batch;
+	pin(w);
+	pthread_mutex_lock(&batch->lock);
+	int last = w->last * batch->unit < batch->n ? w->last * batch->unit : batch->n;
+	for (int i = w->first * batch->unit; i < last; ++i) {
+		batch->emus[i] = emu_new(batch->rom, &null_backend);
+	}
+	pthread_mutex_unlock(&batch->lock);
+}
+
+static void *worker_main(void *arg) {
+	worker_t *w = arg;
+	batch_t *batch = w->batch;
+	unsigned long seen = 0;
+	start_worker(w);
+	pthread_mutex_lock(&batch->lock);
+	if (--batch->starting == 0) {
+		pthread_cond_signal(&batch->finished);
+	}
+	for (;;) {
+		while (batch->step == seen && !batch->quit) {
+			pthread_cond_wait(&batch->go, &batch->lock);
+		}
+		if (batch->quit) {
+			break;
+		}
+		seen = batch->step;
+		pthread_mutex_unlock(&batch->lock);
+
+		run_step(w);
+
+		pthread_mutex_lock(&batch->lock);
+		if (--batch->running == 0) {
+			pthread_cond_signal(&batch->finished);
+		}
+	}
+	pthread_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+/* The NUMA node of cpu, from sysfs. 0 if there is no telling */
+static int cpu_node(int cpu) {
+	char path[64];
+	for (int node = 0; node < MAX_NODES; ++node) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+		if (access(path, F_OK) == 0) {
+			return node;
+		}
+	}
+	return 0;
+}
+
+/* Where each worker runs, and who it steals from */
+static void place_workers(batch_t *batch) {
+	int nthreads = batch->nthreads;
+	cpu_set_t allowed;
+	int ncpus = 0;
+	int cpus[CPU_SETSIZE];
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (int c = 0; c < CPU_SETSIZE; ++c) {
+			if (CPU_ISSET(c, &allowed)) {
+				cpus[ncpus++] = c;
+			}
+		}
+	}
+	if (ncpus == 0 && (batch->flags & (BATCH_PIN_THREADS | BATCH_NUMA))) {
+		log_warn("No CPUs to place batch threads on, leaving them be");
+	}
+	for (int t = 0; t < nthreads; ++t) {
+		worker_t *w = &batch->workers[t];
+		w->cpu = -1;
+		w->node = 0;
+		if (ncpus > 0) {
+			int cpu = cpus[t % ncpus];
+			if (batch->flags & BATCH_PIN_THREADS) {
+				w->cpu = cpu;
+			}
+			if (batch->flags & BATCH_NUMA) {
+				w->node = cpu_node(cpu);
+			}
+		}
+	}
+
+	/* The workers on the same node first, each starting after itself so
+	 * that thieves spread out */
+	for (int t = 0; t < nthreads; ++t) {
+		worker_t *w = &batch->workers[t];
+		int nvictims = 0;
+		w->victims = malloc(nthreads * sizeof(int));
+		if (!w->victims) {
+			log_fatal("batch_new(): Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		for (int pass = 0; pass < 2; ++pass) {
+			for (int k = 1; k < nthreads; ++k) {
+				int v = (t + k) % nthreads;
+				if ((batch->workers[v].node == w->node) == (pass == 0)) {
+					w->victims[nvictims++] = v;
+				}
+			}
+		}
+	}
+}
+
+batch_t *batch_new(char *rom, int n, int nthreads, int flags, reward_fn_t reward) {
+	if (n < 1 || nthreads < 1) {
+		log_fatal("batch_new(): Need at least one console and one thread");
+		exit(EXIT_FAILURE);
+	}
+	int unit = (flags & BATCH_LOCKSTEP) ? LOCKSTEP_LANES : 1;
+	int nunits = (n + unit - 1) / unit;
+	if (nthreads > nunits) {
+		nthreads = nunits;
+	}
+	batch_t *batch = calloc(1, sizeof(batch_t));
+	if (!batch) {
+		log_fatal("batch_new(): Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	batch->n = n;
+	batch->unit = unit;
+	batch->reward = reward;
+	batch->flags = flags;
+	if (flags & BATCH_NUMA) {
+		batch->flags |= BATCH_PIN_THREADS;
+	}
+	batch->rom = rom;
+	batch->nthreads = nthreads;
+	batch->emus = calloc(n, sizeof(emu_t *));
+	batch->workers = aligned_alloc(CACHE_LINE, nthreads * sizeof(worker_t));
+	if (!batch->emus || !batch->workers) {
+		log_fatal("batch_new(): Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(batch->workers, 0, nthreads * sizeof(worker_t));
+	place_workers(batch);
+
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->go, NULL);
+	pthread_cond_init(&batch->finished, NULL);
+	batch->starting = nthreads - 1;
+	/* Worker 0 is the caller of batch_step() */
+	for (int t = 0; t < nthreads; ++t) {
+		worker_t *w = &batch->workers[t];
+		w->batch = batch;
+		w->first = (int)((long)nunits * t / nthreads);
+		w->last = (int)((long)nunits * (t + 1) / nthreads);
+		if (t > 0 && pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+			log_fatal("batch_new(): Could not start thread %d", t);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (batch->workers[0].cpu >= 0 &&
+			pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &batch->caller_cpus) == 0) {
+		batch->caller_pinned = 1;
+	}
+	start_worker(&batch->workers[0]);
+	pthread_mutex_lock(&batch->lock);
+	while (batch->starting > 0) {
+		pthread_cond_wait(&batch->finished, &batch->lock);
+	}
+	pthread_mutex_unlock(&batch->lock);
+	batch->rom = NULL;
+
+	batch->power_on = malloc(emu_state_size(batch->emus[0]));
+	if (!batch->power_on) {
+		log_fatal("batch_new(): Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	emu_save(batch->emus[0], batch->power_on);
+	log_trace("Batch of %d consoles on %d threads", n, nthreads);
+	return batch;
+}
+
+void batch_free(batch_t *batch) {
+	pthread_mutex_lock(&batch->lock);
+	batch->quit = 1;
+	pthread_cond_broadcast(&batch->go);
+	pthread_mutex_unlock(&batch->lock);
+	for (int t = 0; t < batch->nthreads; ++t) {
+		if (t > 0) {
+			pthread_join(batch->workers[t].thread, NULL);
+		}
+		free(batch->workers[t].victims);
+	}
+	if (batch->caller_pinned &&
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &batch->caller_cpus) != 0) {
+		log_warn("Could not unpin the caller's thread");
+	}
+	pthread_cond_destroy(&batch->finished);
+	pthread_cond_destroy(&batch->go);
+	pthread_mutex_destroy(&batch->lock);
+	for (int i = 0; i < batch->n; ++i) {
+		emu_free(batch->emus[i]);
+	}
+	free(batch->power_on);
+	free(batch->workers);
+	free(batch->emus);
+	free(batch);
+}
+
+int batch_size(const batch_t *batch) {
+	return batch->n;
+}
+
+emu_t *batch_emu(batch_t *batch, int i) {
+	return batch->emus[i];
+}
+
+void batch_step(batch_t *batch, const uint16_t *actions, int k,
+		byte_t *obs, int32_t *rewards, _Bool *dones) {
+	pthread_mutex_lock(&batch->lock);
+	batch->actions = actions;
+	batch->frames = k;
+	batch->obs = obs;
+	batch->rewards = rewards;
+	batch->dones = dones;
+	for (int t = 0; t < batch->nthreads; ++t) {
+		worker_t *w = &batch->workers[t];
+		atomic_store(&w->deque, deque_pack(w->first, w->last));
+	}
+	batch->running = batch->nthreads - 1;
+	batch->step++;
+	pthread_cond_broadcast(&batch->go);
+	pthread_mutex_unlock(&batch->lock);
+
+	run_step(&batch->workers[0]);
+
+	pthread_mutex_lock(&batch->lock);
+	while (batch->running > 0) {
+		pthread_cond_wait(&batch->finished, &batch->lock);
+	}
+	pthread_mutex_unlock(&batch->lock);
+}
+
+void batch_reset(batch_t *batch) {
+	for (int i = 0; i < batch->n; ++i) {
+		emu_restore(batch->emus[i], batch->power_on);
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include "emu.h"
+
+/* Bytes of observation per console: the frame, one color index a pixel */
+#define BATCH_OBS_SIZE (VISIBLE_WIDTH * VISIBLE_HEIGHT)
+
+/* Game specific: the reward for the frames a console just ran. Set *done
+ * if the episode is over. A halted CPU always ends the episode
+ */
+typedef int32_t (*reward_fn_t)(emu_t *emu, _Bool *done);
+
+/* n consoles with the same ROM plugged in, stepped together */
+typedef struct batch_t batch_t;
+
+/* Flags for batch_new() */
+enum batch_flags {
+	/* Keep each thread, the caller's included, on a CPU of its own. The
+	 * caller's thread gets its CPUs back from batch_free() */
+	BATCH_PIN_THREADS = 1 << 0,
+	/* Pin threads, and have them help out on their own NUMA node first */
+	BATCH_NUMA = 1 << 1,
+	/* Run consoles LOCKSTEP_LANES at a time by the lockstep interpreter.
+	 * Experimental */
+	BATCH_LOCKSTEP = 1 << 2
+};
+
+/* A batch of n consoles with rom plugged in, stepped by nthreads threads,
+ * the caller's included. reward may be NULL, for no rewards
+ */
+batch_t *batch_new(char *rom, int n, int nthreads, int flags, reward_fn_t reward);
+void batch_free(batch_t *batch);
+
+int batch_size(const batch_t *batch);
+emu_t *batch_emu(batch_t *batch, int i);
+
+/* An action, the controls held for a step. The low byte is the joystick
+ * switches, bit j for joystick_t j as in pia_set_joysticks(), and the
+ * fire buttons are above it
+ */
+#define BATCH_P0_FIRE (1u << 8)
+#define BATCH_P1_FIRE (1u << 9)
+
+/* Run every console for k frames, console i with the controls in
+ * actions[i] held. Console i then leaves its last
+ * frame at obs + i * BATCH_OBS_SIZE, the rewards of the k frames added up
+ * in rewards[i] and whether the episode is over in dones[i]. Any of the
+ * three may be NULL. A console whose episode is over is put back to its
+ * power-on state, to start the next one on the following step.
+ */
+void batch_step(batch_t *batch, const uint16_t *actions, int k,
+		byte_t *obs, int32_t *rewards, _Bool *dones);
+
+/* Put every console back to its power-on state */
+void batch_reset(batch_t *batch);
+
+#endif
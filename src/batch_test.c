@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "pia.h"
+#include "tia.h"
+#include "log.h"
+#include "test_rom.h"
+
+/*
+ * Checks that batch_step() runs each console as emu_run_frame() would on
+ * its own: the same frames, rewards and ends of episode, for every way of
+ * spreading the consoles over threads. The actions change as the steps go,
+ * the fire buttons included, so the consoles drift apart.
+ */
+
+#define NCONSOLES 21
+#define NSTEPS 30
+#define FRAMES_PER_STEP 2
+
+/* SCORE of the test ROM, in BCD, goes up while P0 fire is held */
+#define SCORE 0x82
+
+static const struct {
+	int nthreads;
+	int flags;
+} configs[] = {
+	{ 1, 0 },
+	{ 4, 0 },
+	{ 3, BATCH_PIN_THREADS },
+	{ 2, BATCH_LOCKSTEP },
+	{ 5, BATCH_LOCKSTEP | BATCH_PIN_THREADS }
+};
+
+static int32_t score_reward(emu_t *emu, _Bool *done) {
+	byte_t score = mspace_ram(emu)[SCORE & 0x7f];
+	*done = score >= 0x50;
+	return score;
+}
+
+static uint16_t action(int step, int i) {
+	uint32_t h = (uint32_t)(step / 4 + 1) * 2654435761u ^ (uint32_t)i * 40503u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995;
+	h ^= h >> 15;
+	return h & 0x03ff;
+}
+
+/* What batch_step() should do, a console at a time */
+static void reference_step(emu_t **emus, const byte_t *power_on, const uint16_t *actions,
+		byte_t *obs, int32_t *rewards, _Bool *dones) {
+	for (int i = 0; i < NCONSOLES; ++i) {
+		emu_t *emu = emus[i];
+		pia_set_joysticks(emu, actions[i] & 0xff);
+		tia_set_fire(emu, actions[i] >> 8);
+		rewards[i] = 0;
+		dones[i] = 0;
+		for (int f = 0; f < FRAMES_PER_STEP && !dones[i]; ++f) {
+			emu_run_frame(emu);
+			rewards[i] += score_reward(emu, &dones[i]);
+		}
+		memcpy(obs + (size_t)i * BATCH_OBS_SIZE, tia_frame(emu), BATCH_OBS_SIZE);
+		if (dones[i]) {
+			emu_restore(emu, power_on);
+		}
+	}
+}
+
+static int check_config(char *rom, int nthreads, int flags) {
+	static byte_t want_obs[NCONSOLES * BATCH_OBS_SIZE];
+	static byte_t got_obs[NCONSOLES * BATCH_OBS_SIZE];
+	int32_t want_rewards[NCONSOLES], got_rewards[NCONSOLES];
+	_Bool want_dones[NCONSOLES], got_dones[NCONSOLES];
+	uint16_t actions[NCONSOLES];
+	emu_t *emus[NCONSOLES];
+	int errors = 0;
+	int episodes = 0;
+
+	cpu_set_t before, after;
+	pthread_getaffinity_np(pthread_self(), sizeof(before), &before);
+
+	for (int i = 0; i < NCONSOLES; ++i) {
+		emus[i] = emu_new(rom, &null_backend);
+	}
+	byte_t *power_on = malloc(emu_state_size(emus[0]));
+	emu_save(emus[0], power_on);
+	batch_t *batch = batch_new(rom, NCONSOLES, nthreads, flags, score_reward);
+
+	for (int step = 0; step < NSTEPS; ++step) {
+		for (int i = 0; i < NCONSOLES; ++i) {
+			actions[i] = action(step, i);
+		}
+		reference_step(emus, power_on, actions, want_obs, want_rewards, want_dones);
+		batch_step(batch, actions, FRAMES_PER_STEP, got_obs, got_rewards, got_dones);
+		for (int i = 0; i < NCONSOLES; ++i) {
+			episodes += want_dones[i];
+			if (memcmp(want_obs + (size_t)i * BATCH_OBS_SIZE,
+						got_obs + (size_t)i * BATCH_OBS_SIZE, BATCH_OBS_SIZE) ||
+					want_rewards[i] != got_rewards[i] || want_dones[i] != got_dones[i]) {
+				if (errors++ == 0) {
+					printf("%d threads, flags %d: console %d differs at step %d\n",
+							nthreads, flags, i, step);
+				}
+			}
+		}
+	}
+	batch_free(batch);
+
+	pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+	if (!CPU_EQUAL(&before, &after)) {
+		printf("%d threads, flags %d: the caller's CPUs were not given back\n", nthreads, flags);
+		errors++;
+	}
+	for (int i = 0; i < NCONSOLES; ++i) {
+		emu_free(emus[i]);
+	}
+	free(power_on);
+	printf("%d threads, flags %d: %d episodes, %d mismatches\n", nthreads, flags, episodes, errors);
+	return errors;
+}
+
+int main() {
+	log_set_quiet(1);
+	char *rom = test_rom_file();
+	int errors = 0;
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c) {
+		errors += check_config(rom, configs[c].nthreads, configs[c].flags);
+	}
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,462 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cart.h"
+#include "mspace.h"
+#include "tia.h"
+#include "log.h"
+#include "emu.h"
+
+/*
+ * Cartridges
+ *
+ * The cartridge sees the 4K at 0x1000-0x1fff. Bigger cartridges switch
+ * which part of the ROM shows up there when the CPU touches one of their
+ * 'hotspot' addresses, some have RAM as well. The ROM is never copied: a
+ * bank switch points the cartridge's pages of the memory map at another
+ * part of the ROM image, see mspace_map().
+ *
+ * Pages with a hotspot in them are not mapped directly, their reads and
+ * writes come through cart_read() and cart_write(), which find the byte in
+ * slices[] and then check for a hotspot. For most schemes that is only the
+ * last page, where all the hotspots are.
+ */
+
+#define CART_START 0x1000
+
+/* Show size bytes of mem at start, start and size relative to the
+ * cartridge space. If write is set the CPU can write to them as well. dec
+ * are the decoded instructions of ROM, NULL for RAM */
+static void map_slice(emu_t *emu, addr_t start, addr_t size, byte_t *mem, _Bool write,
+		decoded_t *dec) {
+	cart_map_t *map = &emu->cart_map;
+	for (addr_t offset = 0; offset < size; offset += CART_PAGE) {
+		addr_t page = (start + offset) / CART_PAGE;
+		byte_t *p = mem + offset;
+		map->slices[page] = p;
+		map->decoded[page] = dec && !map->hooked[page] ? dec + offset : NULL;
+		mspace_map(emu, CART_START + start + offset, CART_PAGE,
+				map->hooked[page] ? NULL : p, write ? p : NULL);
+	}
+}
+
+/* ROM is only ever mapped for reading, the image may well be read-only */
+static void map_rom(emu_t *emu, addr_t start, addr_t size, size_t offset) {
+	map_slice(emu, start, size, (byte_t *)emu->cart_map.rom + offset, 0,
+			emu->cart_map.decode + offset);
+}
+
+/* RAM on cartridges has separate addresses to write to and read from */
+static void map_ram(emu_t *emu, addr_t write_start, addr_t read_start, addr_t size,
+		byte_t *ram) {
+	map_slice(emu, write_start, size, ram, 1, NULL);
+	map_slice(emu, read_start, size, ram, 0, NULL);
+}
+
+static unsigned int nbanks(const cart_map_t *map, size_t bank_size) {
+	return map->rom_size / bank_size;
+}
+
+/* Map the banks the selectors in cart_t point at. Every bank switch comes
+ * through here, as does a restored machine state */
+static void map_banks(emu_t *emu) {
+	const cart_t *cart = &emu->machine.cart;
+	const cart_map_t *map = &emu->cart_map;
+	byte_t *ram = emu->machine.cart_ram;
+	switch (cart->type.mapper) {
+		case MAPPER_NONE:
+			map_rom(emu, 0x0000, CART_SIZE, 0);
+			break;
+		case MAPPER_F8:
+		case MAPPER_F6:
+		case MAPPER_F4:
+		case MAPPER_FA:
+		case MAPPER_FE:
+			map_rom(emu, 0x0000, CART_SIZE, (size_t)cart->bank[0] * CART_SIZE);
+			if (cart->type.superchip) {
+				map_ram(emu, 0x0000, 0x0080, 0x0080, ram);
+			}
+			else if (cart->type.mapper == MAPPER_FA) {
+				map_ram(emu, 0x0000, 0x0100, 0x0100, ram);
+			}
+			break;
+		case MAPPER_E0:
+			/* Three 1K slices switch, the last one is fixed */
+			for (int slice = 0; slice < 3; ++slice) {
+				map_rom(emu, slice * 0x0400, 0x0400, (size_t)cart->bank[slice] * 0x0400);
+			}
+			map_rom(emu, 0x0c00, 0x0400, 7 * 0x0400);
+			break;
+		case MAPPER_E7:
+			if (cart->bank[0] == 7) {
+				map_ram(emu, 0x0000, 0x0400, 0x0400, ram);
+			}
+			else {
+				map_rom(emu, 0x0000, 0x0800, (size_t)cart->bank[0] * 0x0800);
+			}
+			map_ram(emu, 0x0800, 0x0900, 0x0100, ram + 0x0400 + cart->bank[1] * 0x0100);
+			/* The last 1.5K of the last bank are fixed */
+			map_rom(emu, 0x0a00, 0x0600, map->rom_size - 0x0600);
+			break;
+		case MAPPER_3F:
+			/* The last 2K are fixed */
+			map_rom(emu, 0x0000, 0x0800, (size_t)cart->bank[0] * 0x0800);
+			map_rom(emu, 0x0800, 0x0800, map->rom_size - 0x0800);
+			break;
+	}
+}
+
+/* First hotspot of the 4K bank schemes */
+static addr_t first_hotspot(const cart_t *cart) {
+	switch (cart->type.mapper) {
+		case MAPPER_F6:
+			return 0x0ff6;
+		case MAPPER_F4:
+			return 0x0ff4;
+		default:
+			return 0x0ff8;
+	}
+}
+
+/* Activision's FE cartridges switch banks on subroutine calls and returns.
+ * Both touch 0x01fe on the stack, the address the CPU goes to next then
+ * picks the bank: 0xfxxx, with A13 set, is bank 0 and 0xdxxx bank 1 */
+static byte_t fe_stack_read(emu_t *emu, addr_t addr) {
+	if ((addr & ADDR_MASK) == 0x01fe) {
+		emu->machine.cart.fe_armed = 1;
+	}
+	return mspace_ram(emu)[addr & 0x7f];
+}
+
+static void fe_stack_write(emu_t *emu, addr_t addr, byte_t b) {
+	if ((addr & ADDR_MASK) == 0x01fe) {
+		emu->machine.cart.fe_armed = 1;
+	}
+	mspace_ram(emu)[addr & 0x7f] = b;
+}
+
+/* Tigervision's 3F cartridges switch banks on writes to 0x00-0x3f, which
+ * are TIA registers as well */
+static void tigervision_write(emu_t *emu, addr_t addr, byte_t b) {
+	tia_write(emu, addr, b);
+	if ((addr & ADDR_MASK) < 0x40) {
+		emu->machine.cart.bank[0] = b % nbanks(&emu->cart_map, 0x0800);
+		map_banks(emu);
+	}
+}
+
+/* Switch banks if addr is a hotspot */
+static void hotspot(emu_t *emu, addr_t addr) {
+	cart_t *cart = &emu->machine.cart;
+	addr_t a = addr & (CART_SIZE - 1);
+	switch (cart->type.mapper) {
+		case MAPPER_F8:
+		case MAPPER_F6:
+		case MAPPER_F4:
+		case MAPPER_FA: {
+			addr_t first = first_hotspot(cart);
+			if (a >= first && a < first + nbanks(&emu->cart_map, CART_SIZE)) {
+				cart->bank[0] = a - first;
+				map_banks(emu);
+			}
+			break;
+		}
+		case MAPPER_E0:
+			if (a >= 0x0fe0 && a <= 0x0ff7) {
+				cart->bank[(a - 0x0fe0) / 8] = a & 0x07;
+				map_banks(emu);
+			}
+			break;
+		case MAPPER_E7:
+			if (a >= 0x0fe0 && a <= 0x0fe7) {
+				cart->bank[0] = a - 0x0fe0;
+				map_banks(emu);
+			}
+			else if (a >= 0x0fe8 && a <= 0x0feb) {
+				cart->bank[1] = a - 0x0fe8;
+				map_banks(emu);
+			}
+			break;
+	}
+}
+
+static byte_t cart_read(emu_t *emu, addr_t addr) {
+	cart_t *cart = &emu->machine.cart;
+	addr_t a = addr & (CART_SIZE - 1);
+	if (cart->fe_armed) {
+		cart->fe_armed = 0;
+		cart->bank[0] = (addr & 0x2000) ? 0 : 1;
+		map_banks(emu);
+	}
+	byte_t b = emu->cart_map.slices[a / CART_PAGE][a % CART_PAGE];
+	hotspot(emu, addr);
+	return b;
+}
+
+static void cart_write(emu_t *emu, addr_t addr, byte_t b) {
+	hotspot(emu, addr);
+}
+
+void cart_insert(emu_t *emu, const byte_t *image, size_t size, cart_type_t t) {
+	cart_t *cart = &emu->machine.cart;
+	if (!cart_fits(t, size)) {
+		log_fatal("cart_insert(): A %zu byte image is too small for %s", size,
+				cart_mapper_name(t.mapper));
+		exit(EXIT_FAILURE);
+	}
+	cart_map_t *map = &emu->cart_map;
+	memset(cart, 0, sizeof(*cart));
+	memset(map, 0, sizeof(*map));
+	memset(emu->machine.cart_ram, 0, sizeof(emu->machine.cart_ram));
+	/* Cartridges smaller than 4K show up repeated across the space */
+	if (size < CART_SIZE) {
+		map->padded = malloc(CART_SIZE);
+		if (!map->padded) {
+			log_fatal("cart_insert(): Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < CART_SIZE; ++i) {
+			map->padded[i] = size ? image[i % size] : 0;
+		}
+		image = map->padded;
+		size = CART_SIZE;
+	}
+	map->rom = image;
+	map->rom_size = size;
+	map->decode = decode_table(image, size);
+	cart->type = t;
+
+	/* Hotspots are all in the last page, FE watches every fetch */
+	for (int page = 0; page < CART_NPAGES; ++page) {
+		map->hooked[page] = cart->type.mapper == MAPPER_FE ||
+			(cart->type.mapper != MAPPER_NONE && cart->type.mapper != MAPPER_3F &&
+			 page == CART_NPAGES - 1);
+	}
+	mspace_map_handlers(emu, CART_START, CART_SIZE, cart_read, cart_write);
+
+	/* The banks switched in at power up */
+	switch (cart->type.mapper) {
+		case MAPPER_F8:
+		case MAPPER_F6:
+		case MAPPER_F4:
+		case MAPPER_FA:
+			cart->bank[0] = nbanks(map, CART_SIZE) - 1;
+			break;
+		case MAPPER_FE:
+			mspace_map(emu, 0x01c0, CART_PAGE, NULL, NULL);
+			mspace_map_handlers(emu, 0x01c0, CART_PAGE, fe_stack_read, fe_stack_write);
+			break;
+		case MAPPER_E0:
+			cart->bank[0] = 4;
+			cart->bank[1] = 5;
+			cart->bank[2] = 6;
+			break;
+		case MAPPER_3F:
+			mspace_map_handlers(emu, 0x0000, CART_PAGE, tia_read, tigervision_write);
+			break;
+	}
+	map_banks(emu);
+	log_trace("Inserted %zuK %s%s cartridge", map->rom_size / 1024,
+			cart_mapper_name(cart->type.mapper), cart->type.superchip ? "SC" : "");
+}
+
+void cart_remap(emu_t *emu) {
+	map_banks(emu);
+}
+
+_Bool cart_fits(cart_type_t t, size_t size) {
+	/* Every bank the scheme can switch in. The 3F banks are counted from
+	 * the image, and a 4K image is repeated to fill smaller ones */
+	switch (t.mapper) {
+		case MAPPER_F8:
+		case MAPPER_FE:
+		case MAPPER_E0:
+			return size >= 0x2000;
+		case MAPPER_FA:
+			return size >= 0x3000;
+		case MAPPER_F6:
+		case MAPPER_E7:
+			return size >= 0x4000;
+		case MAPPER_F4:
+			return size >= 0x8000;
+		default:
+			return 1;
+	}
+}
+
+size_t cart_ram_size(cart_type_t t) {
+	if (t.superchip) {
+		return 0x0080;
+	}
+	switch (t.mapper) {
+		case MAPPER_FA:
+			return 0x0100;
+		case MAPPER_E7:
+			return 0x0800;
+		default:
+			return 0;
+	}
+}
+
+
+/*
+ * Detection
+ *
+ * The size narrows things down, code that touches the hotspots the way a
+ * scheme's games are known to tells the schemes of a size apart.
+ */
+
+typedef struct signature_t {
+	int len;
+	byte_t bytes[5];
+} signature_t;
+
+static int count_signature(const byte_t *image, size_t size, const signature_t *sig) {
+	int n = 0;
+	for (size_t i = 0; i + sig->len <= size; ++i) {
+		if (memcmp(image + i, sig->bytes, sig->len) == 0) {
+			n++;
+		}
+	}
+	return n;
+}
+
+static _Bool has_signature(const byte_t *image, size_t size, const signature_t *sigs, int nsigs) {
+	for (int i = 0; i < nsigs; ++i) {
+		if (count_signature(image, size, &sigs[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static _Bool is_e0(const byte_t *image, size_t size) {
+	static const signature_t sigs[] = {
+		{ 3, { 0x8d, 0xe0, 0x1f } },	/* STA $1FE0 */
+		{ 3, { 0x8d, 0xe0, 0x5f } },	/* STA $5FE0 */
+		{ 3, { 0x8d, 0xe9, 0xff } },	/* STA $FFE9 */
+		{ 3, { 0x0c, 0xe0, 0x1f } },	/* NOP $1FE0 */
+		{ 3, { 0xad, 0xe0, 0x1f } },	/* LDA $1FE0 */
+		{ 3, { 0xad, 0xe9, 0xff } },	/* LDA $FFE9 */
+		{ 3, { 0xad, 0xed, 0xff } },	/* LDA $FFED */
+		{ 3, { 0xad, 0xf3, 0xbf } }	/* LDA $BFF3 */
+	};
+	return has_signature(image, size, sigs, sizeof(sigs) / sizeof(sigs[0]));
+}
+
+static _Bool is_e7(const byte_t *image, size_t size) {
+	static const signature_t sigs[] = {
+		{ 3, { 0xad, 0xe2, 0xff } },	/* LDA $FFE2 */
+		{ 3, { 0xad, 0xe5, 0xff } },	/* LDA $FFE5 */
+		{ 3, { 0xad, 0xe5, 0x1f } },	/* LDA $1FE5 */
+		{ 3, { 0xad, 0xe7, 0x1f } },	/* LDA $1FE7 */
+		{ 3, { 0x0c, 0xe7, 0x1f } },	/* NOP $1FE7 */
+		{ 3, { 0x8d, 0xe7, 0xff } },	/* STA $FFE7 */
+		{ 3, { 0x8d, 0xe7, 0x1f } }	/* STA $1FE7 */
+	};
+	return has_signature(image, size, sigs, sizeof(sigs) / sizeof(sigs[0]));
+}
+
+static _Bool is_fe(const byte_t *image, size_t size) {
+	static const signature_t sigs[] = {
+		{ 5, { 0x20, 0x00, 0xd0, 0xc6, 0xc5 } },	/* JSR $D000; DEC $C5 */
+		{ 5, { 0x20, 0xc3, 0xf8, 0xa5, 0x82 } },	/* JSR $F8C3; LDA $82 */
+		{ 5, { 0xd0, 0xfb, 0x20, 0x73, 0xfe } },	/* BNE $FB; JSR $FE73 */
+		{ 5, { 0x20, 0x00, 0xf0, 0x84, 0xd6 } }	/* JSR $F000; STY $D6 */
+	};
+	return has_signature(image, size, sigs, sizeof(sigs) / sizeof(sigs[0]));
+}
+
+static _Bool is_3f(const byte_t *image, size_t size) {
+	static const signature_t sta_3f = { 2, { 0x85, 0x3f } };	/* STA $3F */
+	return count_signature(image, size, &sta_3f) >= 2;
+}
+
+/* The RAM of a Superchip cartridge is in the first 256 bytes of every bank,
+ * which the ROM image fills with the same 128 bytes twice */
+static _Bool is_superchip(const byte_t *image, size_t size) {
+	for (size_t bank = 0; bank < size; bank += CART_SIZE) {
+		if (memcmp(image + bank, image + bank + 0x80, 0x80) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void cart_eject(emu_t *emu) {
+	decode_release(emu->cart_map.decode);
+	emu->cart_map.decode = NULL;
+	free(emu->cart_map.padded);
+	emu->cart_map.padded = NULL;
+	emu->cart_map.rom = NULL;
+}
+
+cart_type_t cart_detect(const byte_t *image, size_t size) {
+	cart_type_t t = { MAPPER_NONE, 0 };
+	if (size <= CART_SIZE) {
+		return t;
+	}
+	if (size % 0x0800 == 0 && is_3f(image, size)) {
+		t.mapper = MAPPER_3F;
+		return t;
+	}
+	switch (size) {
+		case 0x2000:
+			if (is_e0(image, size)) {
+				t.mapper = MAPPER_E0;
+			}
+			else if (is_fe(image, size)) {
+				t.mapper = MAPPER_FE;
+			}
+			else {
+				t.mapper = MAPPER_F8;
+				t.superchip = is_superchip(image, size);
+			}
+			break;
+		case 0x3000:
+			t.mapper = MAPPER_FA;
+			break;
+		case 0x4000:
+			if (is_e7(image, size)) {
+				t.mapper = MAPPER_E7;
+			}
+			else {
+				t.mapper = MAPPER_F6;
+				t.superchip = is_superchip(image, size);
+			}
+			break;
+		case 0x8000:
+			t.mapper = MAPPER_F4;
+			t.superchip = is_superchip(image, size);
+			break;
+		default:
+			log_fatal("Unsupported cartridge size: %zu bytes", size);
+			exit(EXIT_FAILURE);
+	}
+	return t;
+}
+
+static const char *mapper_names[NMAPPERS] = {
+	"4K", "F8", "F6", "F4", "FE", "E0", "E7", "3F", "FA"
+};
+
+const char *cart_mapper_name(enum mapper_t mapper) {
+	return mapper < NMAPPERS ? mapper_names[mapper] : "?";
+}
+
+_Bool cart_parse_type(const char *name, cart_type_t *t) {
+	for (int m = 0; m < NMAPPERS; ++m) {
+		size_t len = strlen(mapper_names[m]);
+		if (strncmp(name, mapper_names[m], len) != 0) {
+			continue;
+		}
+		/* Only the 4K bank schemes come with a Superchip */
+		_Bool sc = strcmp(name + len, "SC") == 0 &&
+			(m == MAPPER_F8 || m == MAPPER_F6 || m == MAPPER_F4);
+		if (name[len] == '\0' || sc) {
+			t->mapper = m;
+			t->superchip = sc;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef CART_H
+#define CART_H
+
+#include <stddef.h>
+#include "mspace.h"
+#include "decode.h"
+
+/* Bank switching schemes */
+enum mapper_t {
+	MAPPER_NONE,		/* 2K or 4K, no bank switching */
+	MAPPER_F8,		/* 8K, two 4K banks */
+	MAPPER_F6,		/* 16K, four 4K banks */
+	MAPPER_F4,		/* 32K, eight 4K banks */
+	MAPPER_FE,		/* 8K, Activision, banks follow JSR/RTS */
+	MAPPER_E0,		/* 8K, Parker Bros, 1K slices */
+	MAPPER_E7,		/* 16K, M-Network, 2K banks and 2K of RAM */
+	MAPPER_3F,		/* Tigervision, 2K banks selected through the TIA space */
+	MAPPER_FA,		/* 12K, CBS RAM Plus, three 4K banks and 256 bytes of RAM */
+	NMAPPERS
+};
+
+typedef struct cart_type_t {
+	enum mapper_t mapper;
+	_Bool superchip;	/* 128 bytes of RAM on an F8, F6 or F4 cartridge */
+} cart_type_t;
+
+#define CART_SIZE 0x1000
+#define CART_PAGE 64
+#define CART_NPAGES (CART_SIZE / CART_PAGE)
+
+/* The cartridge's part of the machine state. Its RAM is kept with the
+ * console's, see machine_t
+ */
+typedef struct cart_t {
+	cart_type_t type;
+	/* The banks switched in, what they mean depends on the scheme:
+	 * F8, F6, F4, FA, FE, 3F - bank[0] is the bank in the switched part
+	 * E0 - bank[0] to bank[2] are the banks in the three switched slices
+	 * E7 - bank[0] is the ROM bank, 7 for the 1K of RAM, bank[1] is the
+	 *      256 byte RAM bank
+	 */
+	byte_t bank[3];
+	/* FE: 0x01fe was accessed, the next fetch picks the bank */
+	_Bool fe_armed;
+} cart_t;
+
+/* Where the cartridge is mapped, worked out from cart_t and the image */
+typedef struct cart_map_t {
+	const byte_t *rom;
+	size_t rom_size;
+	/* What is read at each page of the cartridge space */
+	byte_t *slices[CART_NPAGES];
+	/* Pages read through cart_read() */
+	_Bool hooked[CART_NPAGES];
+	/* The image's decoded instructions, shared, see decode.h */
+	decoded_t *decode;
+	/* Where the decoded instructions of each page are, NULL for pages
+	 * with no ROM in them or hooked ones
+	 */
+	decoded_t *decoded[CART_NPAGES];
+	/* Images under 4K, repeated to fill it */
+	byte_t *padded;
+} cart_map_t;
+
+/* Guess the type of a cartridge from its size and contents */
+cart_type_t cart_detect(const byte_t *rom, size_t size);
+
+/* Plug in a cartridge. rom must stay around for as long as the cartridge
+ * is in use, as it is mapped into the address space, not copied. It is
+ * never written to
+ */
+void cart_insert(emu_t *emu, const byte_t *rom, size_t size, cart_type_t type);
+/* Unplug it, rom is left alone */
+void cart_eject(emu_t *emu);
+/* Map the banks cart_t says are switched in, after it was restored */
+void cart_remap(emu_t *emu);
+
+/* Whether an image of size bytes has every bank a cartridge of type t
+ * can switch in
+ */
+_Bool cart_fits(cart_type_t t, size_t size);
+
+/* Bytes of RAM on a cartridge of type t */
+size_t cart_ram_size(cart_type_t t);
+
+const char *cart_mapper_name(enum mapper_t mapper);
+/* Parse a type as written by cart_mapper_name(), "SC" appended for the
+ * Superchip. Return 0 if name is not a type
+ */
+_Bool cart_parse_type(const char *name, cart_type_t *type);
+
+#endif
@@ -19,27 +19,65 @@ typedef struct state_t {
 	_Bool P_N;
 } state_t;
 
+/* Registers and run state of the CPU of a console */
+typedef struct cpu_t {
+	cycles_t machine_cycles;
+	addr_t PC;			/* Program Counter */
+	addr_t S;			/* Stack Pointer */
+	byte_t A;			/* Accumulator */
+	byte_t X;			/* General Purpose Register X */
+	byte_t Y;			/* General Purpose Register Y */
+	byte_t P;			/* Program Status Word */
+	_Bool running;
+	/* Set by cpu_yield(), makes cpu_run() return after the current instruction */
+	_Bool yield;
+} cpu_t;
+
 
 void inst_tbl_init();
+void bcd_tbl_init();
+
+/* Decimal mode ADC and SBC by carry, accumulator and operand: the result in
+ * the low byte and N, V, Z and C, as in P, in the high one. See
+ * bcd_tbl_init()
+ */
+extern uint16_t bcd_adc_tbl[2][256][256];
+extern uint16_t bcd_sbc_tbl[2][256][256];
 
 char *inst_name(byte_t opcode);
 byte_t inst_bytes(byte_t opcode);
 byte_t inst_cycles(byte_t opcode);
-byte_t inst_exec(byte_t opcode);
-addr_t fetch_operand(byte_t opcode);
+addr_t fetch_operand(emu_t *emu, byte_t opcode);
 byte_t page_boundary_crossed(addr_t old_addr, addr_t new_addr);
 
-void record_state(state_t *s);
+void record_state(emu_t *emu, state_t *s);
 void disassembler_init();
-void disassemble(byte_t opcode, state_t *s);
+void disassemble(emu_t *emu, byte_t opcode, state_t *s);
 
 /* status == 0 -> halt
  * status == 1 -> run
  */
-void cpu_set_status(_Bool status);
-_Bool cpu_fetch_status();
+void cpu_set_status(emu_t *emu, _Bool status);
+_Bool cpu_fetch_status(emu_t *emu);
+
+/* Execute instructions until at least budget cycles have elapsed, return
+ * the number of cycles actually taken
+ */
+cycles_t cpu_run(emu_t *emu, cycles_t budget);
+
+/* Whether to stop as control is transferred to pc */
+typedef _Bool (*cpu_stop_t)(emu_t *emu, addr_t pc);
+/* The same, returning early as well after a jump, branch, call or return
+ * to a pc stop wants. For cores that run some of the code themselves
+ */
+cycles_t cpu_run_until(emu_t *emu, cycles_t budget, cpu_stop_t stop);
+
+/* Called by devices during a write, makes cpu_run() return after the
+ * current instruction
+ */
+void cpu_yield(emu_t *emu);
 
-void cnt_machine_cycles(cycles_t inc);
-cycles_t fetch_machine_cycles();
+void cnt_machine_cycles(emu_t *emu, cycles_t inc);
+cycles_t fetch_machine_cycles(emu_t *emu);
 
 #endif
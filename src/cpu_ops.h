@@ -0,0 +1,406 @@
+#ifndef CPU_OPS_H
+#define CPU_OPS_H
+
+#include "emu.h"
+
+/*
+ * What each instruction does, spelled out once for cpu_run() and for the
+ * code aotc generates from a ROM (see aot.h), so that the two cannot drift
+ * apart.
+ *
+ * Memory is accessed through fetch_byte()/set_byte(), and before every data
+ * access the cycle counter is published to the console's machine_cycles, so
+ * that a memory mapped device sees the time at which the access happened. A
+ * device may stall the CPU by advancing machine_cycles, which is why it is
+ * read back after a write, and it may ask the CPU to return early through
+ * cpu_yield().
+ *
+ * The macros operate on the locals of the function they are used in: emu
+ * (the console), a, x, y, s, p, pc (the registers), n, z, c (flags, see
+ * below), operand (of the current instruction, as decoded), ea (effective
+ * address), clk (the cycle counter) and end (the cycle to stop at). pc has already been moved past the
+ * instruction and clk advanced by its base cycles. Whenever an instruction
+ * transfers control it calls JUMPED(), which that function defines.
+ */
+
+/* Instruction stream, data reads and data writes */
+#define CODE(addr) fetch_byte(emu, addr)
+#define READ(addr) (emu->machine.cpu.machine_cycles = clk, fetch_byte(emu, addr))
+#define WRITE(addr, b) \
+	do { \
+		emu->machine.cpu.machine_cycles = clk; \
+		set_byte(emu, (addr), (b)); \
+		clk = emu->machine.cpu.machine_cycles; \
+		if (emu->machine.cpu.yield) { \
+			end = clk; \
+		} \
+	} while (0)
+
+#define PUSH(b) do { WRITE(0x0100 | s, (b)); s--; } while (0)
+#define PULL() (s++, READ(0x0100 | s))
+
+/* Operands of the current instruction */
+#define OP8() ((byte_t)operand)
+#define OP16() operand
+
+/* Effective address for each addressing mode. The _R variants are for
+ * instructions that only read memory, those take an extra cycle when the
+ * indexed address crosses a page boundary.
+ */
+#define ZP() ea = OP8()
+#define ZPX() ea = (byte_t)(OP8() + x)
+#define ZPY() ea = (byte_t)(OP8() + y)
+#define ABS() ea = OP16()
+#define ABX() ea = OP16() + x
+#define ABY() ea = OP16() + y
+#define ABX_R() ea = OP16(); clk += ((ea & 0xff) + x) >> 8; ea += x
+#define ABY_R() ea = OP16(); clk += ((ea & 0xff) + y) >> 8; ea += y
+#define INX() \
+	ea = (byte_t)(OP8() + x); \
+	ea = READ(ea) | (READ((byte_t)(ea + 1)) << 8)
+#define INY() \
+	ea = OP8(); \
+	ea = READ(ea) | (READ((byte_t)(ea + 1)) << 8); \
+	ea += y
+#define INY_R() \
+	ea = OP8(); \
+	ea = READ(ea) | (READ((byte_t)(ea + 1)) << 8); \
+	clk += ((ea & 0xff) + y) >> 8; \
+	ea += y
+
+/*
+ * Flags. N, Z and C are set by most instructions and read by few, so they
+ * are kept out of p as what they were computed from: N is bit 7 of n, Z is
+ * set when z is 0, and C is c, 0 or 1. The bits for them in p are stale.
+ * FLAGS() puts P together for the few instructions that need all of it,
+ * and for when the registers are written back. V, D and I stay in p.
+ */
+#define SET_NZ(v) n = z = (v)
+#define SET_C(cond) c = ((cond) ? 1 : 0)
+#define FLAGS() \
+	(byte_t)((p & (byte_t)~(STATUS_N | STATUS_Z | STATUS_C)) | \
+			(n & STATUS_N) | (z ? 0 : STATUS_Z) | c)
+#define SET_FLAGS(v) \
+	do { \
+		p = (v); \
+		n = p; \
+		z = ~p & STATUS_Z; \
+		c = p & STATUS_C; \
+	} while (0)
+
+/* Operations, v is an lvalue for those that modify their operand */
+#define LOAD(r, m) do { r = (m); SET_NZ(r); } while (0)
+#define ORA(m) do { a |= (m); SET_NZ(a); } while (0)
+#define AND(m) do { a &= (m); SET_NZ(a); } while (0)
+#define EOR(m) do { a ^= (m); SET_NZ(a); } while (0)
+
+/* Binary addition, for ADC and SBC */
+#define ADD(m) \
+	do { \
+		byte_t b_ = (m); \
+		unsigned int r_ = a + b_ + c; \
+		SET_C(r_ > 0xff); \
+		p &= (byte_t)~STATUS_V; \
+		p |= ((~(a ^ b_) & (a ^ r_) & 0x80) ? STATUS_V : 0); \
+		a = r_; \
+		SET_NZ(a); \
+	} while (0)
+#define DECIMAL(tbl, m) \
+	do { \
+		uint16_t d_ = tbl[c][a][m]; \
+		a = d_; \
+		SET_FLAGS((p & (byte_t)~(STATUS_N | STATUS_V | STATUS_Z | STATUS_C)) | (d_ >> 8)); \
+	} while (0)
+#define ADC(m) \
+	do { \
+		byte_t m_ = (m); \
+		if (p & STATUS_D) { \
+			DECIMAL(bcd_adc_tbl, m_); \
+		} \
+		else { \
+			ADD(m_); \
+		} \
+	} while (0)
+#define SBC(m) \
+	do { \
+		byte_t m_ = (m); \
+		if (p & STATUS_D) { \
+			DECIMAL(bcd_sbc_tbl, m_); \
+		} \
+		else { \
+			ADD((byte_t)~m_); \
+		} \
+	} while (0)
+#define CMP(r, m) \
+	do { \
+		byte_t m_ = (m); \
+		SET_C(r >= m_); \
+		SET_NZ((byte_t)(r - m_)); \
+	} while (0)
+#define BIT(m) \
+	do { \
+		byte_t m_ = (m); \
+		n = m_; \
+		z = a & m_; \
+		p = (p & (byte_t)~STATUS_V) | (m_ & STATUS_V); \
+	} while (0)
+#define ASL(v) do { SET_C(v & 0x80); v <<= 1; SET_NZ(v); } while (0)
+#define LSR(v) do { SET_C(v & 0x01); v >>= 1; SET_NZ(v); } while (0)
+#define ROL(v) \
+	do { \
+		byte_t c_ = c; \
+		SET_C(v & 0x80); \
+		v = (v << 1) | c_; \
+		SET_NZ(v); \
+	} while (0)
+#define ROR(v) \
+	do { \
+		byte_t c_ = c; \
+		SET_C(v & 0x01); \
+		v = (v >> 1) | (c_ << 7); \
+		SET_NZ(v); \
+	} while (0)
+#define INC(v) do { v++; SET_NZ(v); } while (0)
+#define DEC(v) do { v--; SET_NZ(v); } while (0)
+
+/* Read-modify-write of the byte at ea */
+#define RMW(op) \
+	do { \
+		byte_t v_ = READ(ea); \
+		op(v_); \
+		WRITE(ea, v_); \
+	} while (0)
+
+/* Relative branch, one extra cycle if taken and another one if the target
+ * is on a different page
+ */
+#define BRANCH(cond) \
+	do { \
+		if (cond) { \
+			addr_t t_ = pc + (OP8() ^ 0x80) - 0x80; \
+			clk += 1 + page_boundary_crossed(pc, t_); \
+			pc = t_; \
+			JUMPED(); \
+		} \
+	} while (0)
+
+/* Every instruction, as OP(opcode, statements). Vacant opcodes are left out */
+#define CPU_OPS(OP) \
+	/* Loads */ \
+	OP(0xA9, LOAD(a, OP8())) \
+	OP(0xA5, ZP(); LOAD(a, READ(ea))) \
+	OP(0xB5, ZPX(); LOAD(a, READ(ea))) \
+	OP(0xAD, ABS(); LOAD(a, READ(ea))) \
+	OP(0xBD, ABX_R(); LOAD(a, READ(ea))) \
+	OP(0xB9, ABY_R(); LOAD(a, READ(ea))) \
+	OP(0xA1, INX(); LOAD(a, READ(ea))) \
+	OP(0xB1, INY_R(); LOAD(a, READ(ea))) \
+	\
+	OP(0xA2, LOAD(x, OP8())) \
+	OP(0xA6, ZP(); LOAD(x, READ(ea))) \
+	OP(0xB6, ZPY(); LOAD(x, READ(ea))) \
+	OP(0xAE, ABS(); LOAD(x, READ(ea))) \
+	OP(0xBE, ABY_R(); LOAD(x, READ(ea))) \
+	\
+	OP(0xA0, LOAD(y, OP8())) \
+	OP(0xA4, ZP(); LOAD(y, READ(ea))) \
+	OP(0xB4, ZPX(); LOAD(y, READ(ea))) \
+	OP(0xAC, ABS(); LOAD(y, READ(ea))) \
+	OP(0xBC, ABX_R(); LOAD(y, READ(ea))) \
+	\
+	/* Stores */ \
+	OP(0x85, ZP(); WRITE(ea, a)) \
+	OP(0x95, ZPX(); WRITE(ea, a)) \
+	OP(0x8D, ABS(); WRITE(ea, a)) \
+	OP(0x9D, ABX(); WRITE(ea, a)) \
+	OP(0x99, ABY(); WRITE(ea, a)) \
+	OP(0x81, INX(); WRITE(ea, a)) \
+	OP(0x91, INY(); WRITE(ea, a)) \
+	\
+	OP(0x86, ZP(); WRITE(ea, x)) \
+	OP(0x96, ZPY(); WRITE(ea, x)) \
+	OP(0x8E, ABS(); WRITE(ea, x)) \
+	\
+	OP(0x84, ZP(); WRITE(ea, y)) \
+	OP(0x94, ZPX(); WRITE(ea, y)) \
+	OP(0x8C, ABS(); WRITE(ea, y)) \
+	\
+	/* Transfers */ \
+	OP(0xAA, LOAD(x, a)) \
+	OP(0xA8, LOAD(y, a)) \
+	OP(0xBA, LOAD(x, s)) \
+	OP(0x8A, LOAD(a, x)) \
+	OP(0x9A, s = x) \
+	OP(0x98, LOAD(a, y)) \
+	\
+	/* Stack */ \
+	OP(0x48, PUSH(a)) \
+	OP(0x08, PUSH(FLAGS() | STATUS_B | 0x20)) \
+	OP(0x68, LOAD(a, PULL())) \
+	OP(0x28, SET_FLAGS((PULL() & (byte_t)~STATUS_B) | 0x20)) \
+	\
+	/* Logical */ \
+	OP(0x09, ORA(OP8())) \
+	OP(0x05, ZP(); ORA(READ(ea))) \
+	OP(0x15, ZPX(); ORA(READ(ea))) \
+	OP(0x0D, ABS(); ORA(READ(ea))) \
+	OP(0x1D, ABX_R(); ORA(READ(ea))) \
+	OP(0x19, ABY_R(); ORA(READ(ea))) \
+	OP(0x01, INX(); ORA(READ(ea))) \
+	OP(0x11, INY_R(); ORA(READ(ea))) \
+	\
+	OP(0x29, AND(OP8())) \
+	OP(0x25, ZP(); AND(READ(ea))) \
+	OP(0x35, ZPX(); AND(READ(ea))) \
+	OP(0x2D, ABS(); AND(READ(ea))) \
+	OP(0x3D, ABX_R(); AND(READ(ea))) \
+	OP(0x39, ABY_R(); AND(READ(ea))) \
+	OP(0x21, INX(); AND(READ(ea))) \
+	OP(0x31, INY_R(); AND(READ(ea))) \
+	\
+	OP(0x49, EOR(OP8())) \
+	OP(0x45, ZP(); EOR(READ(ea))) \
+	OP(0x55, ZPX(); EOR(READ(ea))) \
+	OP(0x4D, ABS(); EOR(READ(ea))) \
+	OP(0x5D, ABX_R(); EOR(READ(ea))) \
+	OP(0x59, ABY_R(); EOR(READ(ea))) \
+	OP(0x41, INX(); EOR(READ(ea))) \
+	OP(0x51, INY_R(); EOR(READ(ea))) \
+	\
+	OP(0x24, ZP(); BIT(READ(ea))) \
+	OP(0x2C, ABS(); BIT(READ(ea))) \
+	\
+	/* Arithmetic */ \
+	OP(0x69, ADC(OP8())) \
+	OP(0x65, ZP(); ADC(READ(ea))) \
+	OP(0x75, ZPX(); ADC(READ(ea))) \
+	OP(0x6D, ABS(); ADC(READ(ea))) \
+	OP(0x7D, ABX_R(); ADC(READ(ea))) \
+	OP(0x79, ABY_R(); ADC(READ(ea))) \
+	OP(0x61, INX(); ADC(READ(ea))) \
+	OP(0x71, INY_R(); ADC(READ(ea))) \
+	\
+	OP(0xE9, SBC(OP8())) \
+	OP(0xE5, ZP(); SBC(READ(ea))) \
+	OP(0xF5, ZPX(); SBC(READ(ea))) \
+	OP(0xED, ABS(); SBC(READ(ea))) \
+	OP(0xFD, ABX_R(); SBC(READ(ea))) \
+	OP(0xF9, ABY_R(); SBC(READ(ea))) \
+	OP(0xE1, INX(); SBC(READ(ea))) \
+	OP(0xF1, INY_R(); SBC(READ(ea))) \
+	\
+	OP(0xC9, CMP(a, OP8())) \
+	OP(0xC5, ZP(); CMP(a, READ(ea))) \
+	OP(0xD5, ZPX(); CMP(a, READ(ea))) \
+	OP(0xCD, ABS(); CMP(a, READ(ea))) \
+	OP(0xDD, ABX_R(); CMP(a, READ(ea))) \
+	OP(0xD9, ABY_R(); CMP(a, READ(ea))) \
+	OP(0xC1, INX(); CMP(a, READ(ea))) \
+	OP(0xD1, INY_R(); CMP(a, READ(ea))) \
+	\
+	OP(0xE0, CMP(x, OP8())) \
+	OP(0xE4, ZP(); CMP(x, READ(ea))) \
+	OP(0xEC, ABS(); CMP(x, READ(ea))) \
+	\
+	OP(0xC0, CMP(y, OP8())) \
+	OP(0xC4, ZP(); CMP(y, READ(ea))) \
+	OP(0xCC, ABS(); CMP(y, READ(ea))) \
+	\
+	/* Increments and decrements */ \
+	OP(0xE6, ZP(); RMW(INC)) \
+	OP(0xF6, ZPX(); RMW(INC)) \
+	OP(0xEE, ABS(); RMW(INC)) \
+	OP(0xFE, ABX(); RMW(INC)) \
+	OP(0xE8, INC(x)) \
+	OP(0xC8, INC(y)) \
+	\
+	OP(0xC6, ZP(); RMW(DEC)) \
+	OP(0xD6, ZPX(); RMW(DEC)) \
+	OP(0xCE, ABS(); RMW(DEC)) \
+	OP(0xDE, ABX(); RMW(DEC)) \
+	OP(0xCA, DEC(x)) \
+	OP(0x88, DEC(y)) \
+	\
+	/* Shifts */ \
+	OP(0x0A, ASL(a)) \
+	OP(0x06, ZP(); RMW(ASL)) \
+	OP(0x16, ZPX(); RMW(ASL)) \
+	OP(0x0E, ABS(); RMW(ASL)) \
+	OP(0x1E, ABX(); RMW(ASL)) \
+	\
+	OP(0x4A, LSR(a)) \
+	OP(0x46, ZP(); RMW(LSR)) \
+	OP(0x56, ZPX(); RMW(LSR)) \
+	OP(0x4E, ABS(); RMW(LSR)) \
+	OP(0x5E, ABX(); RMW(LSR)) \
+	\
+	OP(0x2A, ROL(a)) \
+	OP(0x26, ZP(); RMW(ROL)) \
+	OP(0x36, ZPX(); RMW(ROL)) \
+	OP(0x2E, ABS(); RMW(ROL)) \
+	OP(0x3E, ABX(); RMW(ROL)) \
+	\
+	OP(0x6A, ROR(a)) \
+	OP(0x66, ZP(); RMW(ROR)) \
+	OP(0x76, ZPX(); RMW(ROR)) \
+	OP(0x6E, ABS(); RMW(ROR)) \
+	OP(0x7E, ABX(); RMW(ROR)) \
+	\
+	/* Jumps and calls */ \
+	OP(0x4C, pc = OP16(); JUMPED()) \
+	OP(0x6C, \
+		/* The high byte of the target is fetched without carrying \
+		 * into the high byte of the pointer \
+		 */ \
+		ea = OP16(); \
+		pc = READ(ea) | (READ((ea & 0xff00) | ((ea + 1) & 0x00ff)) << 8); \
+		JUMPED()) \
+	OP(0x20, \
+		ea = OP16(); \
+		pc--; \
+		PUSH(pc >> 8); \
+		PUSH(pc); \
+		pc = ea; \
+		JUMPED()) \
+	OP(0x60, \
+		pc = PULL(); \
+		pc |= PULL() << 8; \
+		pc++; \
+		JUMPED()) \
+	OP(0x00, \
+		/* BRK skips a padding byte */ \
+		pc++; \
+		PUSH(pc >> 8); \
+		PUSH(pc); \
+		PUSH(FLAGS() | STATUS_B | 0x20); \
+		p |= STATUS_I; \
+		pc = READ(0xfffe) | (READ(0xffff) << 8); \
+		JUMPED()) \
+	OP(0x40, \
+		SET_FLAGS((PULL() & (byte_t)~STATUS_B) | 0x20); \
+		pc = PULL(); \
+		pc |= PULL() << 8; \
+		JUMPED()) \
+	\
+	/* Branches */ \
+	OP(0x10, BRANCH(!(n & STATUS_N))) \
+	OP(0x30, BRANCH(n & STATUS_N)) \
+	OP(0x50, BRANCH(!(p & STATUS_V))) \
+	OP(0x70, BRANCH(p & STATUS_V)) \
+	OP(0x90, BRANCH(!c)) \
+	OP(0xB0, BRANCH(c)) \
+	OP(0xD0, BRANCH(z)) \
+	OP(0xF0, BRANCH(!z)) \
+	\
+	/* Flags */ \
+	OP(0x18, c = 0) \
+	OP(0x38, c = 1) \
+	OP(0x58, p &= (byte_t)~STATUS_I) \
+	OP(0x78, p |= STATUS_I) \
+	OP(0xB8, p &= (byte_t)~STATUS_V) \
+	OP(0xD8, p &= (byte_t)~STATUS_D) \
+	OP(0xF8, p |= STATUS_D) \
+	\
+	OP(0xEA, )
+
+#endif
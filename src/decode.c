@@ -0,0 +1,72 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "decode.h"
+#include "hash.h"
+#include "log.h"
+
+/*
+ * Decoded Instructions
+ *
+ * ROM decodes the same every time, so there is only one table for each
+ * image, however many consoles have it plugged in. The tables are found by
+ * the hash of the image and freed when the last console lets go of theirs.
+ * Consoles fill in entries as they run, each entry is written whole and
+ * always to the same value, so they need no lock.
+ */
+
+typedef struct table_t {
+	uint64_t hash;
+	size_t size;
+	int users;
+	decoded_t *entries;
+	struct table_t *next;
+} table_t;
+
+static table_t *tables;
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+decoded_t *decode_table(const byte_t *rom, size_t size) {
+	uint64_t hash = hash64(rom, size, 0);
+	pthread_mutex_lock(&tables_lock);
+	table_t *t = tables;
+	while (t && (t->hash != hash || t->size != size)) {
+		t = t->next;
+	}
+	if (!t) {
+		t = malloc(sizeof(*t));
+		decoded_t *entries = calloc(size, sizeof(decoded_t));
+		if (!t || !entries) {
+			log_fatal("decode_table(): Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		t->hash = hash;
+		t->size = size;
+		t->users = 0;
+		t->entries = entries;
+		t->next = tables;
+		tables = t;
+		log_trace("New decode table for ROM %016" PRIx64, hash);
+	}
+	t->users++;
+	pthread_mutex_unlock(&tables_lock);
+	return t->entries;
+}
+
+void decode_release(decoded_t *entries) {
+	if (!entries) {
+		return;
+	}
+	pthread_mutex_lock(&tables_lock);
+	table_t **link = &tables;
+	while (*link && (*link)->entries != entries) {
+		link = &(*link)->next;
+	}
+	table_t *t = *link;
+	if (t && --t->users == 0) {
+		*link = t->next;
+		free(t->entries);
+		free(t);
+	}
+	pthread_mutex_unlock(&tables_lock);
+}
@@ -0,0 +1,20 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mspace.h"
+
+/* An instruction in ROM as the CPU decoded it, 0 until it first ran. What
+ * is in it is up to cpu.c
+ */
+typedef _Atomic uint32_t decoded_t;
+
+/* The decoded instructions of a ROM image, one for each byte of it. All
+ * consoles with the same image share the table, and fill it in as they go
+ */
+decoded_t *decode_table(const byte_t *rom, size_t size);
+/* Done with a table from decode_table() */
+void decode_release(decoded_t *table);
+
+#endif
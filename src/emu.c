@@ -0,0 +1,242 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emu.h"
+#include "cpu.h"
+#include "except.h"
+#include "log.h"
+#include "mspace.h"
+#include "tia.h"
+#include "pia.h"
+#include "romdb.h"
+#include "aot.h"
+#ifdef ENABLE_JIT
+#include "jit.h"
+#endif
+#ifdef HAVE_SDL2
+#include "sdl.h"
+#endif
+
+/*
+ * General Structure of the Emulator
+ *
+ * The unit of work is a frame. emu_run_frame() runs the CPU until the TIA
+ * reports that a frame is complete, and only then polls the input devices
+ * and presents the frame. The TIA is not run alongside the CPU: it catches
+ * up by itself whenever the CPU touches one of its registers, and is synced
+ * once more at the end of a run. Likewise the PIA timer is derived from the
+ * machine cycle count whenever the CPU reads it.
+ *
+ * Each console is an emu_t, which every function that works on a console is
+ * handed. Nothing about a console is kept anywhere else, only the tables
+ * that never change once built are shared.
+ */
+
+/* Build the tables shared by all consoles, the first time round */
+static void init_tables() {
+	static _Bool done = 0;
+	if (done) {
+		return;
+	}
+	except_tbl_init();
+	inst_tbl_init();
+	bcd_tbl_init();
+#ifdef ENABLE_DISASSEMBLER
+	disassembler_init();
+#endif
+	tia_tables_init();
+	done = 1;
+}
+
+emu_t *emu_new(char *rom, const video_backend_t *video) {
+	init_tables();
+	emu_t *emu = calloc(1, sizeof(emu_t));
+	if (!emu) {
+		log_fatal("emu_new(): Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	mspace_init(emu);
+	pia_init(emu);
+	load_cartridge(emu, rom);
+	emu->aot = aot_acquire(emu);
+#ifdef ENABLE_JIT
+	/* A core, if there is one, is used instead */
+	emu->jit = emu->aot ? NULL : jit_acquire(emu);
+#endif
+	tia_init(emu, video);
+	/* Get the CPU runnin' */
+	cpu_set_status(emu, 1);
+	return emu;
+}
+
+void emu_free(emu_t *emu) {
+	tia_free(emu);
+	aot_release(emu->aot);
+#ifdef ENABLE_JIT
+	jit_release(emu->jit);
+#endif
+	cart_eject(emu);
+	unload_cartridge(emu);
+	free(emu);
+}
+
+static emu_t *cli_emu;
+
+static void free_cli_emu() {
+	emu_free(cli_emu);
+	log_trace("Exiting...");
+}
+
+/* The ROM index, under $HOME unless given with --romdb */
+static void open_romdb(const char *path) {
+	char buf[4096];
+	if (path == NULL) {
+		const char *home = getenv("HOME");
+		if (home == NULL) {
+			return;
+		}
+		snprintf(buf, sizeof(buf), "%s/.a26romdb", home);
+		path = buf;
+	}
+	romdb_open(path);
+}
+
+/* Usage: a [--headless] [--frames n] [--romdb file] [--cores dir] rom */
+emu_t *emu_init(int argc, char *argv[], long *frames) {
+	char *rom = NULL;
+	char *romdb = NULL;
+	char *cores = NULL;
+	_Bool headless = 0;
+	*frames = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			headless = 1;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			*frames = strtol(argv[++i], NULL, 10);
+			if (*frames <= 0) {
+				log_fatal("--frames takes a positive number of frames");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "--romdb") == 0 && i + 1 < argc) {
+			romdb = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+			cores = argv[++i];
+		}
+		else if (rom == NULL) {
+			rom = argv[i];
+		}
+	}
+	if (rom == NULL) {
+		log_fatal("No ROM given");
+		exit(EXIT_FAILURE);
+	}
+
+	const video_backend_t *video = &null_backend;
+#ifdef HAVE_SDL2
+	if (!headless) {
+		video = &sdl_backend;
+	}
+#else
+	if (!headless) {
+		log_warn("Built without SDL2, running headless");
+		headless = 1;
+	}
+#endif
+	if (headless && *frames == 0) {
+		log_warn("Running headless without --frames, nothing will end the run");
+	}
+
+	open_romdb(romdb);
+	/* Cores are code, so they are only loaded from where they are asked
+	 * for */
+	if (cores != NULL) {
+		aot_open(cores);
+	}
+	cli_emu = emu_new(rom, video);
+	atexit(free_cli_emu);
+	return cli_emu;
+}
+
+
+#ifdef ENABLE_DISASSEMBLER
+static state_t state;
+#endif
+
+static cycles_t run_cpu(emu_t *emu, cycles_t budget) {
+	/* If CPU is halted, let the time pass */
+	_Bool cpu_status = cpu_fetch_status(emu);
+	if (!cpu_status) {
+		cnt_machine_cycles(emu, budget);
+		return budget;
+	}
+
+#ifdef ENABLE_DISASSEMBLER
+	/* One instruction at a time, so that each can be disassembled */
+	record_state(emu, &state);
+	byte_t opcode = fetch_byte(emu, fetch_PC(emu));
+	cycles_t cycles = cpu_run(emu, 1);
+	disassemble(emu, opcode, &state);
+	return cycles;
+#else
+	if (emu->aot) {
+		return aot_run(emu, budget);
+	}
+#ifdef ENABLE_JIT
+	if (emu->jit) {
+		return jit_run(emu, budget);
+	}
+#endif
+	return cpu_run(emu, budget);
+#endif
+}
+
+cycles_t emu_step_frame(emu_t *emu) {
+	cycles_t start = fetch_machine_cycles(emu);
+	while (!tia_frame_done(emu)) {
+		run_cpu(emu, tia_frame_budget(emu));
+		tia_sync(emu);
+	}
+	cycles_t cycles = fetch_machine_cycles(emu) - start;
+	cnt_pia_cycles(emu, cycles);
+	return cycles;
+}
+
+cycles_t emu_run_frame(emu_t *emu) {
+	cycles_t cycles = emu_step_frame(emu);
+	handle_input(emu);
+	display(emu);
+	return cycles;
+}
+
+cycles_t emu_run_cycles(emu_t *emu, cycles_t n) {
+	cycles_t start = fetch_machine_cycles(emu);
+	cycles_t cycles = 0;
+	while (cycles < n) {
+		run_cpu(emu, n - cycles);
+		cycles = fetch_machine_cycles(emu) - start;
+	}
+	tia_sync(emu);
+	cnt_pia_cycles(emu, cycles);
+	tia_frame_done(emu);
+	return cycles;
+}
+
+size_t emu_state_size(const emu_t *emu) {
+	return offsetof(machine_t, cart_ram) + cart_ram_size(emu->machine.cart.type);
+}
+
+void emu_save(const emu_t *emu, void *buf) {
+	memcpy(buf, &emu->machine, emu_state_size(emu));
+}
+
+/* Only the machine is restored, what is worked out from it is then worked
+ * out again. The frame is left as it is, it is redrawn as the machine runs */
+void emu_restore(emu_t *emu, const void *buf) {
+	memcpy(&emu->machine, buf, emu_state_size(emu));
+	cart_remap(emu);
+	tia_invalidate(emu);
+}
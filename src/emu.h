@@ -0,0 +1,79 @@
+#ifndef EMU_H
+#define EMU_H
+
+#include "mspace.h"
+#include "cpu.h"
+#include "tia.h"
+#include "pia.h"
+#include "cart.h"
+
+/* Everything about a console that changes as it runs, and nothing else:
+ * a few hundred bytes plus the cartridge's RAM, all in one place so that
+ * it stays in cache and can be saved with a memcpy. Keep pointers out of
+ * it, they would not survive emu_restore()
+ */
+typedef struct machine_t {
+	cpu_t cpu;
+	pia_t pia;
+	tia_t tia;
+	cart_t cart;
+	byte_t ram[0x80];
+	/* Last, only as much of it as the cartridge has is saved */
+	byte_t cart_ram[0x800];
+} machine_t;
+
+/* A console. Besides the machine, what is worked out from it: the memory
+ * map, the TIA's masks and frame, where the cartridge banks are. Any
+ * number of them can run side by side, the tables they share are built by
+ * the first emu_new()
+ */
+struct emu_t {
+	machine_t machine;
+	mspace_t mspace;
+	tia_cache_t tia_cache;
+	cart_map_t cart_map;
+	/* Code compiled ahead of time for the cartridge, NULL if there is none */
+	struct aot_t *aot;
+	/* Bit n is set once vacant opcode n has been reported */
+	uint64_t vacant_seen[4];
+#ifdef ENABLE_JIT
+	/* Translated code for the cartridge, NULL if there is none */
+	struct jit_t *jit;
+#endif
+};
+
+/* A console with rom plugged in, presenting frames through video */
+emu_t *emu_new(char *rom, const video_backend_t *video);
+void emu_free(emu_t *emu);
+
+/* A console as set up by the command line, freed at exit. frames is set
+ * to the number of frames to run, 0 to run until the window is closed
+ */
+emu_t *emu_init(int argc, char *argv[], long *frames);
+
+/* Run the machine until the TIA has finished a frame. Input is polled and
+ * the frame is presented once, after it is complete. Returns the number of
+ * CPU cycles the frame took.
+ */
+cycles_t emu_run_frame(emu_t *emu);
+/* The same, without polling for input or presenting the frame, which is
+ * left in tia_frame(). For callers that drive the console themselves
+ */
+cycles_t emu_step_frame(emu_t *emu);
+
+/* Run the machine for at least n CPU cycles. Nothing is polled or presented,
+ * frames completed along the way are dropped. Returns the number of CPU
+ * cycles actually run.
+ */
+cycles_t emu_run_cycles(emu_t *emu, cycles_t n);
+
+/* Size of the buffer emu_save() needs */
+size_t emu_state_size(const emu_t *emu);
+/* Copy the machine state of emu to buf */
+void emu_save(const emu_t *emu, void *buf);
+/* Set the machine state of emu to one saved by emu_save(), from a console
+ * with the same ROM plugged in
+ */
+void emu_restore(emu_t *emu, const void *buf);
+
+#endif
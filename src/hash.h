@@ -0,0 +1,10 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* XXH64 of len bytes at data */
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+
+#endif
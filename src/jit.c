@@ -0,0 +1,1367 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "jit.h"
+#include "cpu.h"
+#include "log.h"
+
+/*
+ * Dynamic Recompiler
+ *
+ * Code in ROM that the interpreter keeps coming back to is translated to
+ * x86-64, a basic block at a time. The interpreter counts how often control
+ * reaches each place in ROM, see jit_wants(), and once a place is hot it
+ * hands over to jit_run(), which translates the block starting there and
+ * runs it.
+ *
+ * A block only does what can be done without the rest of the machine: it
+ * works on the registers, RIOT RAM and whatever ROM (or cartridge RAM)
+ * is read without a hotspot. An instruction that may touch the TIA, the
+ * RIOT's ports and timer or a hotspot is left to the interpreter, which
+ * keeps every device access at the cycle it happens. Where that depends on
+ * an index, the block checks as it runs, and leaves before the instruction
+ * if need be. Code in RAM, which may change, is never translated.
+ *
+ * Blocks are kept by where they start in the image, as decoded
+ * instructions are (see cpu.c), and shared by all consoles with the image.
+ * A block only runs if its pages are switched in as they were when it was
+ * translated, and only if the cycle budget lets every instruction of it
+ * start, so that it stops exactly where the interpreter would have.
+ *
+ * A block has to pay for entering and leaving it. Where only a few
+ * instructions can be translated, the interpreter is left to them, and a
+ * block that keeps leaving early is dropped. While no block runs the
+ * interpreter only looks for hot code now and then.
+ *
+ * Translated blocks are listed in /tmp/perf-<pid>.map, for perf(1).
+ */
+
+/* Times control must reach a place before it is translated */
+#define JIT_HOT 16
+/* Instructions in a block, at least, unless it is a loop. Entering and
+ * leaving a block costs more than the interpreter takes for a few
+ * instructions, so where fewer can be translated, as between one device
+ * access and the next, the interpreter is left to them */
+#define MIN_INSTS 4
+/* Calls of jit_run() left to the interpreter alone in a row, at most, see
+ * jit_run() */
+#define MAX_QUIET 64
+/* Instructions in a block, at most */
+#define MAX_INSTS 32
+/* Bytes of code for a block, at most */
+#define MAX_CODE 16384
+#define MAX_EXITS (6 * MAX_INSTS)
+/* Executable memory is taken from the system this much at a time */
+#define CHUNK_SIZE (256 * 1024)
+#define CACHE_LINE 64
+
+/* A translated block: called with the console and nz_flags, runs its
+ * instructions and returns the cycles they took, with EARLY_EXIT set if it
+ * left before one of them for the interpreter to carry out
+ */
+typedef cycles_t (*block_fn_t)(emu_t *emu, const byte_t *nz_flags);
+
+#define EARLY_EXIT 0x80000000u
+
+typedef struct block_t {
+	addr_t pc;
+	/* Pages the block's code is on */
+	int npages;
+	/* Cycles before the last instruction starts, at most */
+	cycles_t lead;
+	/* Offset in the image */
+	size_t offset;
+	/* Runs that left before MIN_INSTS instructions' worth of cycles, less
+	 * those that did not. A block that keeps leaving that early costs more
+	 * than it saves, and is dropped once this reaches JIT_HOT */
+	_Atomic int misses;
+	block_fn_t fn;
+	struct block_t *next;
+} block_t;
+
+typedef struct chunk_t {
+	byte_t *mem;
+	size_t used;
+	struct chunk_t *next;
+} chunk_t;
+
+struct jit_t {
+	/* The image's decoded instructions, which identify it */
+	const decoded_t *decode;
+	size_t size;
+	int users;
+	/* By offset in the image */
+	_Atomic(block_t *) *blocks;
+	_Atomic byte_t *heat;
+	block_t *all_blocks;
+	chunk_t *chunks;
+	/* Calls of jit_run() still to leave to the interpreter, and how many
+	 * in a row no block ran in */
+	_Atomic int skip;
+	_Atomic int quiet;
+	struct jit_t *next;
+};
+
+/* Where nothing could be translated */
+static block_t untranslatable;
+
+/* N and Z for each value */
+static byte_t nz_flags[256];
+
+/* Held to look up, translate or free */
+static pthread_mutex_t jit_lock = PTHREAD_MUTEX_INITIALIZER;
+static jit_t *jits;
+static FILE *perf_map;
+
+/******************* X86-64 ****************************/
+
+enum reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11 };
+enum cc { CC_O = 0, CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5, CC_A = 7 };
+
+/* While a block runs the 6502 registers are kept in x86 ones: A, X, Y and
+ * S in the low bytes of r8-r11 and P in cl. rdi is the console, rsi
+ * nz_flags, edx counts the cycles that depend on the data. eax and ebx are
+ * free for the address and the operand
+ */
+#define REG_A R8
+#define REG_X R9
+#define REG_Y R10
+#define REG_S R11
+#define REG_P RCX
+
+#define OFF(member) ((int32_t)offsetof(emu_t, member))
+#define RAM_OFF OFF(machine.ram)
+
+typedef struct exit_t {
+	size_t at;		/* rel32 to patch */
+	int32_t pc;		/* -1 if set already */
+	cycles_t cycles;
+	_Bool early;	/* Before an instruction of the block */
+} exit_t;
+
+typedef struct asm_t {
+	byte_t buf[MAX_CODE];
+	size_t len;
+	exit_t exits[MAX_EXITS];
+	int nexits;
+} asm_t;
+
+static void emit(asm_t *as, byte_t b) {
+	as->buf[as->len++] = b;
+}
+
+static void emit32(asm_t *as, uint32_t v) {
+	for (int i = 0; i < 4; ++i) {
+		emit(as, v >> (8 * i));
+	}
+}
+
+/* REX prefix, byte forces one so that byte registers 4-7 are spl-dil */
+static void rex(asm_t *as, int w, int r, int x, int b, _Bool byte) {
+	byte_t v = 0x40 | w << 3 | (r >> 3) << 2 | ((x > 0 ? x : 0) >> 3) << 1 | b >> 3;
+	if (v != 0x40 || byte) {
+		emit(as, v);
+	}
+}
+
+static void modrm_reg(asm_t *as, int r, int rm) {
+	emit(as, 0xc0 | (r & 7) << 3 | (rm & 7));
+}
+
+/* [base + index * (1 << scale) + disp], no index if it is -1 */
+static void modrm_mem(asm_t *as, int r, int base, int index, int scale, int32_t disp) {
+	if (index < 0) {
+		emit(as, 0x80 | (r & 7) << 3 | (base & 7));
+	}
+	else {
+		emit(as, 0x84 | (r & 7) << 3);
+		emit(as, scale << 6 | (index & 7) << 3 | (base & 7));
+	}
+	emit32(as, disp);
+}
+
+/* op r/m8, r8 */
+static void rr8(asm_t *as, byte_t op, int dst, int src) {
+	rex(as, 0, src, 0, dst, 1);
+	emit(as, op);
+	modrm_reg(as, src, dst);
+}
+
+/* Group 1 op r/m8, imm8 */
+static void ri8(asm_t *as, int ext, int reg, byte_t imm) {
+	rex(as, 0, 0, 0, reg, 1);
+	emit(as, 0x80);
+	modrm_reg(as, ext, reg);
+	emit(as, imm);
+}
+
+static void mov_ri8(asm_t *as, int reg, byte_t imm) {
+	rex(as, 0, 0, 0, reg, 1);
+	emit(as, 0xb0 + (reg & 7));
+	emit(as, imm);
+}
+
+static void test_ri8(asm_t *as, int reg, byte_t imm) {
+	rex(as, 0, 0, 0, reg, 1);
+	emit(as, 0xf6);
+	modrm_reg(as, 0, reg);
+	emit(as, imm);
+}
+
+/* Unary and shift by one on r/m8 */
+static void unary8(asm_t *as, byte_t op, int ext, int reg) {
+	rex(as, 0, 0, 0, reg, 1);
+	emit(as, op);
+	modrm_reg(as, ext, reg);
+}
+
+#define INC8(as, r) unary8(as, 0xfe, 0, r)
+#define DEC8(as, r) unary8(as, 0xfe, 1, r)
+#define NOT8(as, r) unary8(as, 0xf6, 2, r)
+#define RCL8(as, r) unary8(as, 0xd0, 2, r)
+#define RCR8(as, r) unary8(as, 0xd0, 3, r)
+#define SHL8(as, r) unary8(as, 0xd0, 4, r)
+#define SHR8(as, r) unary8(as, 0xd0, 5, r)
+
+static void setcc(asm_t *as, enum cc cc, int reg) {
+	rex(as, 0, 0, 0, reg, 1);
+	emit(as, 0x0f);
+	emit(as, 0x90 + cc);
+	modrm_reg(as, 0, reg);
+}
+
+static void movzx_rr(asm_t *as, int dst, int src) {
+	rex(as, 0, dst, 0, src, 1);
+	emit(as, 0x0f);
+	emit(as, 0xb6);
+	modrm_reg(as, dst, src);
+}
+
+static void movzx_rm(asm_t *as, int dst, int base, int index, int32_t disp) {
+	rex(as, 0, dst, index, base, 0);
+	emit(as, 0x0f);
+	emit(as, 0xb6);
+	modrm_mem(as, dst, base, index, 0, disp);
+}
+
+/* op r8, m8 and op m8, r8 */
+static void rm8(asm_t *as, byte_t op, int reg, int base, int index, int32_t disp) {
+	rex(as, 0, reg, index, base, 1);
+	emit(as, op);
+	modrm_mem(as, reg, base, index, 0, disp);
+}
+
+#define LOAD8(as, r, b, i, d) rm8(as, 0x8a, r, b, i, d)
+#define STORE8(as, r, b, i, d) rm8(as, 0x88, r, b, i, d)
+#define OR_LOAD8(as, r, b, i, d) rm8(as, 0x0a, r, b, i, d)
+
+static void store8_imm(asm_t *as, int base, int index, int32_t disp, byte_t imm) {
+	rex(as, 0, 0, index, base, 0);
+	emit(as, 0xc6);
+	modrm_mem(as, 0, base, index, 0, disp);
+	emit(as, imm);
+}
+
+static void cmp_m8_imm(asm_t *as, int base, int index, int32_t disp, byte_t imm) {
+	rex(as, 0, 0, index, base, 0);
+	emit(as, 0x80);
+	modrm_mem(as, 7, base, index, 0, disp);
+	emit(as, imm);
+}
+
+/* movzx r32, m16 */
+static void movzx16_rm(asm_t *as, int dst, int base, int index, int scale, int32_t disp) {
+	rex(as, 0, dst, index, base, 0);
+	emit(as, 0x0f);
+	emit(as, 0xb7);
+	modrm_mem(as, dst, base, index, scale, disp);
+}
+
+static void mov_ri64(asm_t *as, int reg, uint64_t imm) {
+	rex(as, 1, 0, 0, reg, 0);
+	emit(as, 0xb8 + (reg & 7));
+	emit32(as, imm);
+	emit32(as, imm >> 32);
+}
+
+static void load64(asm_t *as, int reg, int base, int index, int scale, int32_t disp) {
+	rex(as, 1, reg, index, base, 0);
+	emit(as, 0x8b);
+	modrm_mem(as, reg, base, index, scale, disp);
+}
+
+static void store16(asm_t *as, int reg, int base, int32_t disp) {
+	emit(as, 0x66);
+	rex(as, 0, reg, 0, base, 0);
+	emit(as, 0x89);
+	modrm_mem(as, reg, base, -1, 0, disp);
+}
+
+static void store16_imm(asm_t *as, int base, int32_t disp, uint16_t imm) {
+	emit(as, 0x66);
+	rex(as, 0, 0, 0, base, 0);
+	emit(as, 0xc7);
+	modrm_mem(as, 0, base, -1, 0, disp);
+	emit(as, imm);
+	emit(as, imm >> 8);
+}
+
+/* Group 1 op r/m32, imm32 */
+static void ri32(asm_t *as, int ext, int reg, uint32_t imm) {
+	rex(as, 0, 0, 0, reg, 0);
+	emit(as, 0x81);
+	modrm_reg(as, ext, reg);
+	emit32(as, imm);
+}
+
+/* Group 1 op r/m32, sign extended imm8 */
+static void ri32s8(asm_t *as, int ext, int reg, int8_t imm) {
+	rex(as, 0, 0, 0, reg, 0);
+	emit(as, 0x83);
+	modrm_reg(as, ext, reg);
+	emit(as, imm);
+}
+
+/* op r/m32, r32 */
+static void rr32(asm_t *as, byte_t op, int dst, int src) {
+	rex(as, 0, src, 0, dst, 0);
+	emit(as, op);
+	modrm_reg(as, src, dst);
+}
+
+static void test_ri32(asm_t *as, int reg, uint32_t imm) {
+	rex(as, 0, 0, 0, reg, 0);
+	emit(as, 0xf7);
+	modrm_reg(as, 0, reg);
+	emit32(as, imm);
+}
+
+static void shift32(asm_t *as, int ext, int reg, byte_t imm) {
+	rex(as, 0, 0, 0, reg, 0);
+	emit(as, 0xc1);
+	modrm_reg(as, ext, reg);
+	emit(as, imm);
+}
+
+enum { ADD = 0, OR = 1, ADC = 2, SBB = 3, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+#define SHL 4
+#define SHR 5
+#define OP8(op) ((op) << 3)		/* op r/m8, r8 */
+#define MOV8 0x88
+#define TEST8 0x84
+#define MOV32 0x89
+#define OR32 0x09
+#define ADD32 0x01
+
+/* bt ecx, 0: the 6502 carry to the x86 one */
+static void carry_in(asm_t *as) {
+	emit(as, 0x0f);
+	emit(as, 0xba);
+	modrm_reg(as, 4, RCX);
+	emit(as, 0);
+}
+
+/* Jumps within the block, patched once the target is known */
+static size_t jcc_fwd(asm_t *as, enum cc cc) {
+	emit(as, 0x0f);
+	emit(as, 0x80 + cc);
+	emit32(as, 0);
+	return as->len - 4;
+}
+
+static size_t jmp_fwd(asm_t *as) {
+	emit(as, 0xe9);
+	emit32(as, 0);
+	return as->len - 4;
+}
+
+static void patch(asm_t *as, size_t at, size_t target) {
+	uint32_t rel = target - (at + 4);
+	memcpy(as->buf + at, &rel, 4);
+}
+
+/* Leave the block at pc, cycles from its start, -1 for a pc already set */
+static void add_exit(asm_t *as, size_t at, int32_t pc, cycles_t cycles, _Bool early) {
+	exit_t *e = &as->exits[as->nexits++];
+	e->at = at;
+	e->pc = pc;
+	e->cycles = cycles;
+	e->early = early;
+}
+
+static void exit_if(asm_t *as, enum cc cc, int32_t pc, cycles_t cycles) {
+	add_exit(as, jcc_fwd(as, cc), pc, cycles, 0);
+}
+
+static void exit_always(asm_t *as, int32_t pc, cycles_t cycles) {
+	add_exit(as, jmp_fwd(as), pc, cycles, 0);
+}
+
+static void prologue(asm_t *as) {
+	emit(as, 0x53);		/* push rbx */
+	movzx_rm(as, REG_A, RDI, -1, OFF(machine.cpu.A));
+	movzx_rm(as, REG_X, RDI, -1, OFF(machine.cpu.X));
+	movzx_rm(as, REG_Y, RDI, -1, OFF(machine.cpu.Y));
+	movzx_rm(as, REG_S, RDI, -1, OFF(machine.cpu.S));
+	movzx_rm(as, REG_P, RDI, -1, OFF(machine.cpu.P));
+	rr32(as, XOR << 3 | 1, RDX, RDX);
+}
+
+/* Store the registers, return eax + edx cycles */
+static void epilogue(asm_t *as) {
+	STORE8(as, REG_A, RDI, -1, OFF(machine.cpu.A));
+	STORE8(as, REG_X, RDI, -1, OFF(machine.cpu.X));
+	STORE8(as, REG_Y, RDI, -1, OFF(machine.cpu.Y));
+	STORE8(as, REG_P, RDI, -1, OFF(machine.cpu.P));
+	movzx_rr(as, REG_S, REG_S);
+	ri32(as, OR, REG_S, 0x0100);
+	store16(as, REG_S, RDI, OFF(machine.cpu.S));
+	rr32(as, ADD32, RAX, RDX);
+	emit(as, 0x5b);		/* pop rbx */
+	emit(as, 0xc3);		/* ret */
+}
+
+/* An exit sets eax to its cycles, and maybe the PC, and then goes through
+ * the epilogue
+ */
+static void emit_exits(asm_t *as) {
+	size_t end = as->len;
+	epilogue(as);
+	for (int i = 0; i < as->nexits; ++i) {
+		const exit_t *e = &as->exits[i];
+		patch(as, e->at, as->len);
+		emit(as, 0xb8);		/* mov eax, imm32 */
+		emit32(as, e->cycles | (e->early ? EARLY_EXIT : 0));
+		if (e->pc >= 0) {
+			store16_imm(as, RDI, OFF(machine.cpu.PC), e->pc);
+		}
+		patch(as, jmp_fwd(as), end);
+	}
+}
+
+/******************* 6502 ****************************/
+
+enum op {
+	NONE, LDA, LDX, LDY, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+	PHA, PHP, PLA, PLP, ORA, AND_, EOR, BIT, ADC_, SBC, CMP_, CPX, CPY,
+	INC, DEC, INX, INY, DEX, DEY, ASL, LSR, ROL, ROR, JMP, JSR, RTS,
+	BPL, BMI, BVC, BVS, BCC, BCS, BNE, BEQ,
+	CLC, SEC, CLI, SEI, CLV, CLD, SED, NOP
+};
+
+enum mode { IMP, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IZX, IZY, REL };
+
+typedef struct op_t {
+	byte_t op;
+	byte_t mode;
+} op_t;
+
+/* What can be translated. Not here: BRK, RTI, JMP (ind) and the vacant
+ * opcodes
+ */
+static const op_t ops[256] = {
+	[0xA9] = { LDA, IMM }, [0xA5] = { LDA, ZP }, [0xB5] = { LDA, ZPX }, [0xAD] = { LDA, ABS },
+	[0xBD] = { LDA, ABX }, [0xB9] = { LDA, ABY }, [0xA1] = { LDA, IZX }, [0xB1] = { LDA, IZY },
+	[0xA2] = { LDX, IMM }, [0xA6] = { LDX, ZP }, [0xB6] = { LDX, ZPY }, [0xAE] = { LDX, ABS },
+	[0xBE] = { LDX, ABY },
+	[0xA0] = { LDY, IMM }, [0xA4] = { LDY, ZP }, [0xB4] = { LDY, ZPX }, [0xAC] = { LDY, ABS },
+	[0xBC] = { LDY, ABX },
+
+	[0x85] = { STA, ZP }, [0x95] = { STA, ZPX }, [0x8D] = { STA, ABS }, [0x9D] = { STA, ABX },
+	[0x99] = { STA, ABY }, [0x81] = { STA, IZX }, [0x91] = { STA, IZY },
+	[0x86] = { STX, ZP }, [0x96] = { STX, ZPY }, [0x8E] = { STX, ABS },
+	[0x84] = { STY, ZP }, [0x94] = { STY, ZPX }, [0x8C] = { STY, ABS },
+
+	[0xAA] = { TAX, IMP }, [0xA8] = { TAY, IMP }, [0xBA] = { TSX, IMP }, [0x8A] = { TXA, IMP },
+	[0x9A] = { TXS, IMP }, [0x98] = { TYA, IMP },
+	[0x48] = { PHA, IMP }, [0x08] = { PHP, IMP }, [0x68] = { PLA, IMP }, [0x28] = { PLP, IMP },
+
+	[0x09] = { ORA, IMM }, [0x05] = { ORA, ZP }, [0x15] = { ORA, ZPX }, [0x0D] = { ORA, ABS },
+	[0x1D] = { ORA, ABX }, [0x19] = { ORA, ABY }, [0x01] = { ORA, IZX }, [0x11] = { ORA, IZY },
+	[0x29] = { AND_, IMM }, [0x25] = { AND_, ZP }, [0x35] = { AND_, ZPX }, [0x2D] = { AND_, ABS },
+	[0x3D] = { AND_, ABX }, [0x39] = { AND_, ABY }, [0x21] = { AND_, IZX }, [0x31] = { AND_, IZY },
+	[0x49] = { EOR, IMM }, [0x45] = { EOR, ZP }, [0x55] = { EOR, ZPX }, [0x4D] = { EOR, ABS },
+	[0x5D] = { EOR, ABX }, [0x59] = { EOR, ABY }, [0x41] = { EOR, IZX }, [0x51] = { EOR, IZY },
+	[0x24] = { BIT, ZP }, [0x2C] = { BIT, ABS },
+
+	[0x69] = { ADC_, IMM }, [0x65] = { ADC_, ZP }, [0x75] = { ADC_, ZPX }, [0x6D] = { ADC_, ABS },
+	[0x7D] = { ADC_, ABX }, [0x79] = { ADC_, ABY }, [0x61] = { ADC_, IZX }, [0x71] = { ADC_, IZY },
+	[0xE9] = { SBC, IMM }, [0xE5] = { SBC, ZP }, [0xF5] = { SBC, ZPX }, [0xED] = { SBC, ABS },
+	[0xFD] = { SBC, ABX }, [0xF9] = { SBC, ABY }, [0xE1] = { SBC, IZX }, [0xF1] = { SBC, IZY },
+	[0xC9] = { CMP_, IMM }, [0xC5] = { CMP_, ZP }, [0xD5] = { CMP_, ZPX }, [0xCD] = { CMP_, ABS },
+	[0xDD] = { CMP_, ABX }, [0xD9] = { CMP_, ABY }, [0xC1] = { CMP_, IZX }, [0xD1] = { CMP_, IZY },
+	[0xE0] = { CPX, IMM }, [0xE4] = { CPX, ZP }, [0xEC] = { CPX, ABS },
+	[0xC0] = { CPY, IMM }, [0xC4] = { CPY, ZP }, [0xCC] = { CPY, ABS },
+
+	[0xE6] = { INC, ZP }, [0xF6] = { INC, ZPX }, [0xEE] = { INC, ABS }, [0xFE] = { INC, ABX },
+	[0xC6] = { DEC, ZP }, [0xD6] = { DEC, ZPX }, [0xCE] = { DEC, ABS }, [0xDE] = { DEC, ABX },
+	[0xE8] = { INX, IMP }, [0xC8] = { INY, IMP }, [0xCA] = { DEX, IMP }, [0x88] = { DEY, IMP },
+
+	[0x0A] = { ASL, IMP }, [0x06] = { ASL, ZP }, [0x16] = { ASL, ZPX }, [0x0E] = { ASL, ABS },
+	[0x1E] = { ASL, ABX },
+	[0x4A] = { LSR, IMP }, [0x46] = { LSR, ZP }, [0x56] = { LSR, ZPX }, [0x4E] = { LSR, ABS },
+	[0x5E] = { LSR, ABX },
+	[0x2A] = { ROL, IMP }, [0x26] = { ROL, ZP }, [0x36] = { ROL, ZPX }, [0x2E] = { ROL, ABS },
+	[0x3E] = { ROL, ABX },
+	[0x6A] = { ROR, IMP }, [0x66] = { ROR, ZP }, [0x76] = { ROR, ZPX }, [0x6E] = { ROR, ABS },
+	[0x7E] = { ROR, ABX },
+
+	[0x4C] = { JMP, ABS }, [0x20] = { JSR, ABS }, [0x60] = { RTS, IMP },
+
+	[0x10] = { BPL, REL }, [0x30] = { BMI, REL }, [0x50] = { BVC, REL }, [0x70] = { BVS, REL },
+	[0x90] = { BCC, REL }, [0xB0] = { BCS, REL }, [0xD0] = { BNE, REL }, [0xF0] = { BEQ, REL },
+
+	[0x18] = { CLC, IMP }, [0x38] = { SEC, IMP }, [0x58] = { CLI, IMP }, [0x78] = { SEI, IMP },
+	[0xB8] = { CLV, IMP }, [0xD8] = { CLD, IMP }, [0xF8] = { SED, IMP },
+	[0xEA] = { NOP, IMP },
+};
+
+static _Bool is_store(int op) {
+	return op == STA || op == STX || op == STY;
+}
+
+static _Bool is_rmw(int op) {
+	return op == INC || op == DEC || op == ASL || op == LSR || op == ROL || op == ROR;
+}
+
+static _Bool is_branch(int op) {
+	return op >= BPL && op <= BEQ;
+}
+
+/* Reads that take an extra cycle when indexing crosses a page */
+static _Bool has_penalty(const op_t *o) {
+	return (o->mode == ABX || o->mode == ABY || o->mode == IZY) &&
+		!is_store(o->op) && !is_rmw(o->op);
+}
+
+static _Bool is_ram(addr_t a) {
+	return (a & 0x1280) == 0x0080;
+}
+
+/* Cartridge space read straight from memory, with no hotspot */
+static _Bool is_cart(const emu_t *emu, addr_t a) {
+	return (a & 0x1000) && !emu->cart_map.hooked[(a & (CART_SIZE - 1)) / CART_PAGE];
+}
+
+/* Whether the instruction can be translated at all. What depends on the
+ * registers is checked as the block runs
+ */
+static _Bool translatable(const emu_t *emu, const op_t *o, addr_t operand) {
+	if (o->op == NONE) {
+		return 0;
+	}
+	_Bool writes = is_store(o->op) || is_rmw(o->op);
+	switch (o->mode) {
+		case ZP:
+			return is_ram(operand);
+		case ABS:
+			if (o->op == JMP || o->op == JSR) {
+				return 1;
+			}
+			return is_ram(operand) || (!writes && is_cart(emu, operand));
+		case IZY:
+			/* The pointer must be in RAM */
+			return (byte_t)operand >= 0x80 && (byte_t)operand < 0xff;
+	}
+	return 1;
+}
+
+typedef struct inst_t {
+	addr_t pc;
+	byte_t opcode;
+	addr_t operand;
+	cycles_t before;	/* Cycles from the start of the block */
+} inst_t;
+
+/* Leave before in, for the interpreter to carry it out */
+static void leave_if(asm_t *as, enum cc cc, const inst_t *in) {
+	add_exit(as, jcc_fwd(as, cc), in->pc, in->before, 1);
+}
+
+/* Where the operand of an instruction is */
+enum loc {
+	LOC_IMM,		/* operand itself */
+	LOC_RAM,		/* operand in RAM */
+	LOC_CART,		/* operand in the cartridge space */
+	LOC_RAM_AT,		/* RAM at eax, checked and masked */
+	LOC_ANY			/* eax, anywhere */
+};
+
+/* Extra cycle for a read that crossed a page. Emitted once the operand has
+ * been read, eax is free then
+ */
+static void penalty(asm_t *as, const inst_t *in, const op_t *o) {
+	if (o->mode == IZY) {
+		movzx_rm(as, RAX, RDI, -1, RAM_OFF + (in->operand & 0x7f));
+		rr8(as, OP8(ADD), RAX, REG_Y);
+		ri32s8(as, ADC, RDX, 0);
+	}
+	else if (in->operand & 0xff) {
+		/* index >= 0x100 - low byte of the base: no borrow, one more */
+		ri8(as, CMP, o->mode == ABX ? REG_X : REG_Y, 0x100 - (in->operand & 0xff));
+		ri32s8(as, SBB, RDX, -1);
+	}
+}
+
+/* Leave unless eax is in RAM, which it is masked to */
+static void check_ram(asm_t *as, const inst_t *in) {
+	rr32(as, MOV32, RBX, RAX);
+	ri32(as, AND, RBX, 0x1280);
+	ri32(as, CMP, RBX, 0x0080);
+	leave_if(as, CC_NE, in);
+	ri32(as, AND, RAX, 0x7f);
+}
+
+/* Work out the operand's address, leaving where it can not be */
+static enum loc address(asm_t *as, const inst_t *in, const op_t *o) {
+	int index = o->mode == ZPY || o->mode == ABY ? REG_Y : REG_X;
+	switch (o->mode) {
+		case IMM:
+			return LOC_IMM;
+		case ZP:
+			return LOC_RAM;
+		case ABS:
+			return is_ram(in->operand) ? LOC_RAM : LOC_CART;
+		case ZPX:
+		case ZPY:
+			/* Zero page wraps, RAM is its upper half */
+			movzx_rr(as, RAX, index);
+			ri8(as, ADD, RAX, in->operand);
+			test_ri8(as, RAX, 0x80);
+			leave_if(as, CC_E, in);
+			ri32(as, AND, RAX, 0x7f);
+			return LOC_RAM_AT;
+		case ABX:
+		case ABY:
+			movzx_rr(as, RAX, index);
+			ri32(as, ADD, RAX, in->operand);
+			return LOC_ANY;
+		case IZX:
+			/* Both bytes of the pointer in RAM */
+			movzx_rr(as, RAX, REG_X);
+			ri8(as, ADD, RAX, in->operand);
+			ri8(as, CMP, RAX, 0x80);
+			leave_if(as, CC_B, in);
+			ri8(as, CMP, RAX, 0xff);
+			leave_if(as, CC_E, in);
+			ri32(as, AND, RAX, 0x7f);
+			movzx_rm(as, RBX, RDI, RAX, RAM_OFF + 1);
+			shift32(as, SHL, RBX, 8);
+			movzx_rm(as, RAX, RDI, RAX, RAM_OFF);
+			rr32(as, OR32, RAX, RBX);
+			return LOC_ANY;
+		case IZY:
+			movzx_rm(as, RAX, RDI, -1, RAM_OFF + (in->operand & 0x7f) + 1);
+			shift32(as, SHL, RAX, 8);
+			movzx_rm(as, RBX, RDI, -1, RAM_OFF + (in->operand & 0x7f));
+			rr32(as, OR32, RAX, RBX);
+			movzx_rr(as, RBX, REG_Y);
+			rr32(as, ADD32, RAX, RBX);
+			return LOC_ANY;
+	}
+	return LOC_IMM;
+}
+
+/* Read the operand into ebx */
+static void read_operand(asm_t *as, const inst_t *in, const op_t *o, enum loc loc) {
+	switch (loc) {
+		case LOC_IMM:
+			mov_ri8(as, RBX, in->operand);
+			break;
+		case LOC_RAM:
+			movzx_rm(as, RBX, RDI, -1, RAM_OFF + (in->operand & 0x7f));
+			break;
+		case LOC_CART: {
+			addr_t a = in->operand & (CART_SIZE - 1);
+			load64(as, RBX, RDI, -1, 0, OFF(cart_map.slices) + (a / CART_PAGE) * 8);
+			movzx_rm(as, RBX, RBX, -1, a % CART_PAGE);
+			break;
+		}
+		case LOC_RAM_AT:
+			movzx_rm(as, RBX, RDI, RAX, RAM_OFF);
+			break;
+		case LOC_ANY: {
+			rr32(as, MOV32, RBX, RAX);
+			ri32(as, AND, RBX, 0x1280);
+			ri32(as, CMP, RBX, 0x0080);
+			size_t not_ram = jcc_fwd(as, CC_NE);
+			ri32(as, AND, RAX, 0x7f);
+			movzx_rm(as, RBX, RDI, RAX, RAM_OFF);
+			if (has_penalty(o)) {
+				penalty(as, in, o);
+			}
+			size_t done = jmp_fwd(as);
+			/* The cartridge, unless the page is hooked */
+			patch(as, not_ram, as->len);
+			test_ri32(as, RAX, 0x1000);
+			leave_if(as, CC_E, in);
+			rr32(as, MOV32, RBX, RAX);
+			shift32(as, SHR, RBX, 6);
+			ri32(as, AND, RBX, CART_NPAGES - 1);
+			cmp_m8_imm(as, RDI, RBX, OFF(cart_map.hooked), 0);
+			leave_if(as, CC_NE, in);
+			load64(as, RBX, RDI, RBX, 3, OFF(cart_map.slices));
+			ri32(as, AND, RAX, CART_PAGE - 1);
+			movzx_rm(as, RBX, RBX, RAX, 0);
+			if (has_penalty(o)) {
+				penalty(as, in, o);
+			}
+			patch(as, done, as->len);
+			return;
+		}
+	}
+	if (has_penalty(o)) {
+		penalty(as, in, o);
+	}
+}
+
+/* Write reg to the operand, which is in RAM */
+static void write_operand(asm_t *as, const inst_t *in, enum loc loc, int reg) {
+	if (loc == LOC_RAM) {
+		STORE8(as, reg, RDI, -1, RAM_OFF + (in->operand & 0x7f));
+	}
+	else {
+		STORE8(as, reg, RDI, RAX, RAM_OFF);
+	}
+}
+
+static void set_nz(asm_t *as, int reg) {
+	movzx_rr(as, RAX, reg);
+	ri8(as, AND, REG_P, (byte_t)~(STATUS_N | STATUS_Z));
+	OR_LOAD8(as, REG_P, RSI, RAX, 0);
+}
+
+/* The 6502 carry from al */
+static void set_c(asm_t *as) {
+	ri8(as, AND, REG_P, (byte_t)~STATUS_C);
+	rr8(as, OP8(OR), REG_P, RAX);
+}
+
+/* Binary ADC of bl. SBC adds the complement as the interpreter does */
+static void adc(asm_t *as) {
+	carry_in(as);
+	rr8(as, OP8(ADC), REG_A, RBX);
+	setcc(as, CC_B, RAX);
+	setcc(as, CC_O, RBX);
+	ri8(as, AND, REG_P, (byte_t)~(STATUS_C | STATUS_V));
+	rr8(as, OP8(OR), REG_P, RAX);
+	unary8(as, 0xc0, SHL, RBX);	/* shl bl, 6 */
+	emit(as, 6);
+	rr8(as, OP8(OR), REG_P, RBX);
+	set_nz(as, REG_A);
+}
+
+/* Decimal ADC or SBC of bl, looked up in the interpreter's tbl */
+static void decimal(asm_t *as, const void *tbl) {
+	movzx_rr(as, RBX, RBX);
+	movzx_rr(as, RAX, REG_A);
+	shift32(as, SHL, RAX, 8);
+	rr32(as, OR32, RBX, RAX);
+	movzx_rr(as, RAX, REG_P);
+	ri32(as, AND, RAX, STATUS_C);
+	shift32(as, SHL, RAX, 16);
+	rr32(as, OR32, RBX, RAX);
+	mov_ri64(as, RAX, (uintptr_t)tbl);
+	movzx16_rm(as, RAX, RAX, RBX, 1, 0);
+	rr8(as, MOV8, REG_A, RAX);
+	shift32(as, SHR, RAX, 8);
+	ri8(as, AND, REG_P, (byte_t)~(STATUS_N | STATUS_V | STATUS_Z | STATUS_C));
+	rr8(as, OP8(OR), REG_P, RAX);
+}
+
+/* ADC, or SBC if subtract, of bl in whichever mode P is in */
+static void add(asm_t *as, _Bool subtract) {
+	test_ri8(as, REG_P, STATUS_D);
+	size_t bcd = jcc_fwd(as, CC_NE);
+	if (subtract) {
+		NOT8(as, RBX);
+	}
+	adc(as);
+	size_t done = jmp_fwd(as);
+	patch(as, bcd, as->len);
+	decimal(as, subtract ? bcd_sbc_tbl : bcd_adc_tbl);
+	patch(as, done, as->len);
+}
+
+static void compare(asm_t *as, int reg) {
+	rr8(as, MOV8, RAX, reg);
+	rr8(as, OP8(SUB), RAX, RBX);
+	setcc(as, CC_AE, RBX);
+	ri8(as, AND, REG_P, (byte_t)~STATUS_C);
+	rr8(as, OP8(OR), REG_P, RBX);
+	set_nz(as, RAX);
+}
+
+/* Shift, rotate, increment or decrement reg, x86 flags hold the carry
+ * out of the shifts after
+ */
+static void modify(asm_t *as, int op, int reg) {
+	switch (op) {
+		case ASL: SHL8(as, reg); break;
+		case LSR: SHR8(as, reg); break;
+		case ROL: carry_in(as); RCL8(as, reg); break;
+		case ROR: carry_in(as); RCR8(as, reg); break;
+		case INC: INC8(as, reg); break;
+		case DEC: DEC8(as, reg); break;
+	}
+}
+
+static int reg_of(int op) {
+	switch (op) {
+		case LDX: case STX: case CPX:
+			return REG_X;
+		case LDY: case STY: case CPY:
+			return REG_Y;
+	}
+	return REG_A;
+}
+
+/* Stack accesses are to RAM while S, before or after, is in its upper half */
+static void check_stack(asm_t *as, const inst_t *in, byte_t lo, byte_t hi) {
+	movzx_rr(as, RAX, REG_S);
+	ri32(as, SUB, RAX, lo);
+	ri32(as, CMP, RAX, hi - lo);
+	leave_if(as, CC_A, in);
+}
+
+static void push(asm_t *as, const inst_t *in, int reg) {
+	check_stack(as, in, 0x80, 0xff);
+	movzx_rr(as, RAX, REG_S);
+	ri32(as, AND, RAX, 0x7f);
+	STORE8(as, reg, RDI, RAX, RAM_OFF);
+	DEC8(as, REG_S);
+}
+
+static void pull(asm_t *as, const inst_t *in, int reg) {
+	check_stack(as, in, 0x7f, 0xfe);
+	INC8(as, REG_S);
+	movzx_rr(as, RAX, REG_S);
+	ri32(as, AND, RAX, 0x7f);
+	LOAD8(as, reg, RDI, RAX, RAM_OFF);
+}
+
+/* Translate one instruction. Control transfers leave the block */
+static void translate_inst(asm_t *as, const inst_t *in) {
+	const op_t *o = &ops[in->opcode];
+	addr_t next = in->pc + inst_bytes(in->opcode);
+	cycles_t after = in->before + inst_cycles(in->opcode);
+	enum loc loc = address(as, in, o);
+	if ((is_store(o->op) || is_rmw(o->op)) && loc == LOC_ANY) {
+		check_ram(as, in);
+		loc = LOC_RAM_AT;
+	}
+
+	switch (o->op) {
+		case LDA: case LDX: case LDY:
+			read_operand(as, in, o, loc);
+			rr8(as, MOV8, reg_of(o->op), RBX);
+			set_nz(as, reg_of(o->op));
+			break;
+		case STA: case STX: case STY:
+			write_operand(as, in, loc, reg_of(o->op));
+			break;
+
+		case TAX: rr8(as, MOV8, REG_X, REG_A); set_nz(as, REG_X); break;
+		case TAY: rr8(as, MOV8, REG_Y, REG_A); set_nz(as, REG_Y); break;
+		case TSX: rr8(as, MOV8, REG_X, REG_S); set_nz(as, REG_X); break;
+		case TXA: rr8(as, MOV8, REG_A, REG_X); set_nz(as, REG_A); break;
+		case TXS: rr8(as, MOV8, REG_S, REG_X); break;
+		case TYA: rr8(as, MOV8, REG_A, REG_Y); set_nz(as, REG_A); break;
+
+		case PHA:
+			push(as, in, REG_A);
+			break;
+		case PHP:
+			rr8(as, MOV8, RBX, REG_P);
+			ri8(as, OR, RBX, STATUS_B | 0x20);
+			push(as, in, RBX);
+			break;
+		case PLA:
+			pull(as, in, REG_A);
+			set_nz(as, REG_A);
+			break;
+		case PLP:
+			pull(as, in, REG_P);
+			ri8(as, AND, REG_P, (byte_t)~STATUS_B);
+			ri8(as, OR, REG_P, 0x20);
+			break;
+
+		case ORA: case AND_: case EOR:
+			read_operand(as, in, o, loc);
+			rr8(as, OP8(o->op == ORA ? OR : o->op == AND_ ? AND : XOR), REG_A, RBX);
+			set_nz(as, REG_A);
+			break;
+		case BIT:
+			read_operand(as, in, o, loc);
+			ri8(as, AND, REG_P, (byte_t)~(STATUS_N | STATUS_V | STATUS_Z));
+			rr8(as, MOV8, RAX, RBX);
+			ri8(as, AND, RAX, STATUS_N | STATUS_V);
+			rr8(as, OP8(OR), REG_P, RAX);
+			rr8(as, TEST8, RBX, REG_A);
+			setcc(as, CC_E, RAX);
+			SHL8(as, RAX);
+			rr8(as, OP8(OR), REG_P, RAX);
+			break;
+		case ADC_:
+			read_operand(as, in, o, loc);
+			add(as, 0);
+			break;
+		case SBC:
+			read_operand(as, in, o, loc);
+			add(as, 1);
+			break;
+		case CMP_: case CPX: case CPY:
+			read_operand(as, in, o, loc);
+			compare(as, reg_of(o->op));
+			break;
+
+		case INX: INC8(as, REG_X); set_nz(as, REG_X); break;
+		case INY: INC8(as, REG_Y); set_nz(as, REG_Y); break;
+		case DEX: DEC8(as, REG_X); set_nz(as, REG_X); break;
+		case DEY: DEC8(as, REG_Y); set_nz(as, REG_Y); break;
+
+		case INC: case DEC: case ASL: case LSR: case ROL: case ROR: {
+			int reg = o->mode == IMP ? REG_A : RBX;
+			if (reg == RBX) {
+				read_operand(as, in, o, loc);
+			}
+			modify(as, o->op, reg);
+			/* mov keeps the carry */
+			if (reg == RBX) {
+				write_operand(as, in, loc, RBX);
+			}
+			if (o->op != INC && o->op != DEC) {
+				setcc(as, CC_B, RAX);
+				set_c(as);
+			}
+			set_nz(as, reg);
+			break;
+		}
+
+		case JMP:
+			exit_always(as, in->operand, after);
+			return;
+		case JSR: {
+			addr_t ret = next - 1;
+			check_stack(as, in, 0x81, 0xff);
+			movzx_rr(as, RAX, REG_S);
+			ri32(as, AND, RAX, 0x7f);
+			store8_imm(as, RDI, RAX, RAM_OFF, ret >> 8);
+			store8_imm(as, RDI, RAX, RAM_OFF - 1, ret);
+			ri8(as, SUB, REG_S, 2);
+			exit_always(as, in->operand, after);
+			return;
+		}
+		case RTS:
+			check_stack(as, in, 0x7f, 0xfd);
+			movzx_rr(as, RAX, REG_S);
+			ri32(as, ADD, RAX, 1);
+			ri32(as, AND, RAX, 0x7f);
+			movzx_rm(as, RBX, RDI, RAX, RAM_OFF);
+			movzx_rm(as, RAX, RDI, RAX, RAM_OFF + 1);
+			shift32(as, SHL, RAX, 8);
+			rr32(as, OR32, RAX, RBX);
+			ri32(as, ADD, RAX, 1);
+			store16(as, RAX, RDI, OFF(machine.cpu.PC));
+			ri8(as, ADD, REG_S, 2);
+			exit_always(as, -1, after);
+			return;
+
+		case BPL: case BMI: case BVC: case BVS: case BCC: case BCS: case BNE: case BEQ: {
+			static const byte_t flag[] = { STATUS_N, STATUS_V, STATUS_C, STATUS_Z };
+			int b = o->op - BPL;
+			addr_t target = next + (int8_t)in->operand;
+			test_ri8(as, REG_P, flag[b / 2]);
+			exit_if(as, b % 2 ? CC_NE : CC_E, target,
+					after + 1 + page_boundary_crossed(next, target));
+			exit_always(as, next, after);
+			return;
+		}
+
+		case CLC: ri8(as, AND, REG_P, (byte_t)~STATUS_C); break;
+		case SEC: ri8(as, OR, REG_P, STATUS_C); break;
+		case CLI: ri8(as, AND, REG_P, (byte_t)~STATUS_I); break;
+		case SEI: ri8(as, OR, REG_P, STATUS_I); break;
+		case CLV: ri8(as, AND, REG_P, (byte_t)~STATUS_V); break;
+		case CLD: ri8(as, AND, REG_P, (byte_t)~STATUS_D); break;
+		case SED: ri8(as, OR, REG_P, STATUS_D); break;
+		case NOP: break;
+	}
+}
+
+/******************* BLOCKS ****************************/
+
+static int cart_page(addr_t pc) {
+	return pc & 0x1000 ? (pc & (CART_SIZE - 1)) / CART_PAGE : -1;
+}
+
+/* Whether pages first to first + n - 1 show consecutive parts of the image */
+static _Bool contiguous(const emu_t *emu, int first, int n) {
+	const cart_map_t *map = &emu->cart_map;
+	if (first + n > CART_NPAGES) {
+		return 0;
+	}
+	for (int i = 1; i < n; ++i) {
+		if (!map->decoded[first + i] || map->decoded[first + i] != map->decoded[first] + i * CART_PAGE) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* The byte of ROM at a, if the block starting on page first can reach it */
+static _Bool rom_byte(const emu_t *emu, int first, addr_t a, byte_t *b) {
+	const cart_map_t *map = &emu->cart_map;
+	int page = cart_page(a);
+	if (page < first || !contiguous(emu, first, page - first + 1)) {
+		return 0;
+	}
+	*b = map->rom[(map->decoded[page] - map->decode) + a % CART_PAGE];
+	return 1;
+}
+
+/*
+ * Memory is never writable and executable at once. A block's code is
+ * copied to pages of its own, which are then made executable and no
+ * longer writable, so that the pages of blocks other threads may be
+ * running are never touched again. Each block starts a cache line further
+ * into its page than the one before, or they would all start in the same
+ * cache sets.
+ */
+static byte_t *load_code(jit_t *jit, const byte_t *code, size_t len) {
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	chunk_t *c = jit->chunks;
+	if (!c || c->used + len + 2 * page_size > CHUNK_SIZE) {
+		c = malloc(sizeof(*c));
+		if (!c) {
+			return NULL;
+		}
+		c->mem = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (c->mem == MAP_FAILED) {
+			log_warn("jit: Out of memory for code, translating no more");
+			free(c);
+			return NULL;
+		}
+		c->used = 0;
+		c->next = jit->chunks;
+		jit->chunks = c;
+	}
+	const size_t skew = (c->used / page_size * CACHE_LINE) % page_size;
+	const size_t size = (skew + len + page_size - 1) & ~(page_size - 1);
+	byte_t *p = c->mem + c->used + skew;
+	memcpy(p, code, len);
+	if (mprotect(c->mem + c->used, size, PROT_READ | PROT_EXEC)) {
+		log_warn("jit: Code can not be made executable, translating no more");
+		return NULL;
+	}
+	c->used += size;
+	return p;
+}
+
+static void write_perf_map(const void *code, size_t size, addr_t pc, size_t offset) {
+	if (!perf_map) {
+		char path[64];
+		snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+		perf_map = fopen(path, "w");
+		if (!perf_map) {
+			return;
+		}
+	}
+	fprintf(perf_map, "%lx %zx a26_%04x_%zx\n", (unsigned long)code, size, pc, offset);
+	fflush(perf_map);
+}
+
+/* Whether in, the last instruction of the block at pc, may go back to its
+ * start. jit_run() runs the block again straight away then, however short
+ * it is */
+static _Bool loops_back(const inst_t *in, addr_t pc) {
+	const op_t *o = &ops[in->opcode];
+	if (is_branch(o->op)) {
+		return (addr_t)(in->pc + 2 + (int8_t)in->operand) == pc;
+	}
+	return o->op == JMP && in->operand == pc;
+}
+
+/* Translate the block at pc, offset in the image. Called with jit_lock
+ * held */
+static block_t *translate(jit_t *jit, emu_t *emu, addr_t pc, size_t offset) {
+	static asm_t as;
+	int first = cart_page(pc);
+	inst_t insts[MAX_INSTS];
+	int n = 0;
+	addr_t a = pc;
+	/* Cycles before each instruction, not counting and counting those
+	 * that depend on the data */
+	cycles_t before = 0, worst = 0, lead = 0;
+	as.len = 0;
+	as.nexits = 0;
+	prologue(&as);
+	while (n < MAX_INSTS && as.len < MAX_CODE / 2) {
+		inst_t *in = &insts[n];
+		byte_t bytes[3];
+		if (!rom_byte(emu, first, a, &bytes[0])) {
+			break;
+		}
+		int len = inst_bytes(bytes[0]);
+		_Bool ok = 1;
+		for (int i = 1; i < len && ok; ++i) {
+			ok = rom_byte(emu, first, a + i, &bytes[i]);
+		}
+		in->pc = a;
+		in->opcode = bytes[0];
+		in->operand = len == 1 ? 0 : len == 2 ? bytes[1] : bytes[1] | bytes[2] << 8;
+		in->before = before;
+		const op_t *o = &ops[in->opcode];
+		if (!ok || !translatable(emu, o, in->operand)) {
+			break;
+		}
+		translate_inst(&as, in);
+		n++;
+		a += len;
+		lead = worst;
+		before += inst_cycles(in->opcode);
+		worst += inst_cycles(in->opcode) + has_penalty(o);
+		if (o->op == JMP || o->op == JSR || o->op == RTS || is_branch(o->op)) {
+			break;
+		}
+	}
+	if (n == 0 || (n < MIN_INSTS && !loops_back(&insts[n - 1], pc))) {
+		return &untranslatable;
+	}
+	const op_t *last = &ops[insts[n - 1].opcode];
+	if (!(last->op == JMP || last->op == JSR || last->op == RTS || is_branch(last->op))) {
+		exit_always(&as, a, before);
+	}
+	emit_exits(&as);
+
+	block_t *b = malloc(sizeof(*b));
+	byte_t *code = b ? load_code(jit, as.buf, as.len) : NULL;
+	if (!code) {
+		free(b);
+		return &untranslatable;
+	}
+	b->pc = pc;
+	b->npages = cart_page(a - 1) - first + 1;
+	b->lead = lead;
+	b->offset = offset;
+	atomic_init(&b->misses, 0);
+	/* ISO C has no cast from data to code pointers */
+	memcpy(&b->fn, &code, sizeof(b->fn));
+	b->next = jit->all_blocks;
+	jit->all_blocks = b;
+	write_perf_map(code, as.len, pc, offset);
+	return b;
+}
+
+/******************* RUNNING ****************************/
+
+/* Offset in the image of the ROM at pc, -1 if pc is not in ROM or on a
+ * hooked page */
+static ptrdiff_t rom_offset(const emu_t *emu, addr_t pc) {
+	const cart_map_t *map = &emu->cart_map;
+	int page = cart_page(pc);
+	if (page < 0 || !map->decoded[page]) {
+		return -1;
+	}
+	return (map->decoded[page] - map->decode) + pc % CART_PAGE;
+}
+
+/* Count one more arrival at offset, return whether it is hot now. Counts
+ * may be lost to other threads, it does not matter
+ */
+static _Bool heat_up(jit_t *jit, ptrdiff_t offset) {
+	byte_t heat = atomic_load_explicit(&jit->heat[offset], memory_order_relaxed);
+	if (heat < JIT_HOT) {
+		atomic_store_explicit(&jit->heat[offset], ++heat, memory_order_relaxed);
+	}
+	return heat >= JIT_HOT;
+}
+
+_Bool jit_wants(emu_t *emu, addr_t pc) {
+	jit_t *jit = emu->jit;
+	ptrdiff_t offset = rom_offset(emu, pc);
+	if (offset < 0) {
+		return 0;
+	}
+	block_t *b = atomic_load_explicit(&jit->blocks[offset], memory_order_acquire);
+	if (b) {
+		return b->fn && b->pc == pc;
+	}
+	return heat_up(jit, offset);
+}
+
+/* The block at pc, translated now if it is hot, NULL if there is none or
+ * its pages are not switched in */
+static block_t *find_block(emu_t *emu, addr_t pc) {
+	jit_t *jit = emu->jit;
+	ptrdiff_t offset = rom_offset(emu, pc);
+	if (offset < 0) {
+		return NULL;
+	}
+	block_t *b = atomic_load_explicit(&jit->blocks[offset], memory_order_acquire);
+	if (!b) {
+		if (!heat_up(jit, offset)) {
+			return NULL;
+		}
+		pthread_mutex_lock(&jit_lock);
+		b = atomic_load_explicit(&jit->blocks[offset], memory_order_relaxed);
+		if (!b) {
+			b = translate(jit, emu, pc, offset);
+			atomic_store_explicit(&jit->blocks[offset], b, memory_order_release);
+		}
+		pthread_mutex_unlock(&jit_lock);
+	}
+	if (!b->fn || b->pc != pc || !contiguous(emu, cart_page(pc), b->npages)) {
+		return NULL;
+	}
+	return b;
+}
+
+/* Count a run of b, which left early or not after cycles. Counts may be
+ * lost to other threads, as in heat_up() */
+static void count_run(jit_t *jit, block_t *b, _Bool early, cycles_t cycles) {
+	int misses = atomic_load_explicit(&b->misses, memory_order_relaxed);
+	if (early && cycles < 2 * MIN_INSTS) {
+		misses++;
+		if (misses >= JIT_HOT) {
+			/* The code stays until jit_release(), it may be running */
+			atomic_store_explicit(&jit->blocks[b->offset], &untranslatable, memory_order_release);
+		}
+	}
+	else if (misses > 0) {
+		misses--;
+	}
+	else {
+		return;
+	}
+	atomic_store_explicit(&b->misses, misses, memory_order_relaxed);
+}
+
+cycles_t jit_run(emu_t *emu, cycles_t budget) {
+	cpu_t *cpu = &emu->machine.cpu;
+	if (!cpu->running) {
+		return 0;
+	}
+	/* Looking for hot code costs the interpreter a little at every jump.
+	 * Once no block has run for JIT_HOT calls, as in a kernel with a device
+	 * access every few instructions, it only looks on some of the calls,
+	 * fewer and fewer of them, and otherwise runs as fast as without
+	 * translations */
+	jit_t *jit = emu->jit;
+	int skip = atomic_load_explicit(&jit->skip, memory_order_relaxed);
+	if (skip > 0) {
+		atomic_store_explicit(&jit->skip, skip - 1, memory_order_relaxed);
+		return cpu_run(emu, budget);
+	}
+	const cycles_t start = cpu->machine_cycles;
+	const cycles_t end = start + budget;
+	_Bool after_block = 0;
+	_Bool ran = 0;
+	cpu->yield = 0;
+	while ((scycles_t)(end - cpu->machine_cycles) > 0) {
+		/* A block runs if all its instructions start within the budget */
+		block_t *b = find_block(emu, cpu->PC);
+		if (b && (scycles_t)(end - cpu->machine_cycles - b->lead) > 0) {
+			cycles_t cycles = b->fn(emu, nz_flags);
+			count_run(jit, b, cycles & EARLY_EXIT, cycles & ~EARLY_EXIT);
+			ran = 1;
+			cycles &= ~EARLY_EXIT;
+			cpu->machine_cycles += cycles;
+			/* Unless it left before its first instruction */
+			after_block = 1;
+			if (cycles) {
+				continue;
+			}
+		}
+		/* Where a block ended the interpreter takes a single step, so that
+		 * the code after it can get hot as well. Otherwise it runs until
+		 * control reaches code that is, see jit_wants()
+		 */
+		cpu_run_until(emu, after_block ? 1 : end - cpu->machine_cycles, jit_wants);
+		after_block = 0;
+		if (cpu->yield || !cpu->running) {
+			break;
+		}
+	}
+	int quiet = 0;
+	if (!ran) {
+		quiet = atomic_load_explicit(&jit->quiet, memory_order_relaxed) + 1;
+		if (quiet >= JIT_HOT) {
+			atomic_store_explicit(&jit->skip, quiet < MAX_QUIET ? quiet : MAX_QUIET,
+					memory_order_relaxed);
+		}
+	}
+	atomic_store_explicit(&jit->quiet, quiet, memory_order_relaxed);
+	return cpu->machine_cycles - start;
+}
+
+jit_t *jit_acquire(emu_t *emu) {
+	const cart_map_t *map = &emu->cart_map;
+	/* Activision's banks follow the stack, nothing is left to translate */
+	if (!map->decode || emu->machine.cart.type.mapper == MAPPER_FE) {
+		return NULL;
+	}
+	pthread_mutex_lock(&jit_lock);
+	if (!nz_flags[0]) {
+		for (int v = 0; v < 256; ++v) {
+			nz_flags[v] = (v & STATUS_N) | (v == 0 ? STATUS_Z : 0);
+		}
+	}
+	jit_t *jit = jits;
+	while (jit && jit->decode != map->decode) {
+		jit = jit->next;
+	}
+	if (!jit) {
+		jit = calloc(1, sizeof(*jit));
+		if (jit) {
+			jit->blocks = calloc(map->rom_size, sizeof(*jit->blocks));
+			jit->heat = calloc(map->rom_size, sizeof(*jit->heat));
+		}
+		if (!jit || !jit->blocks || !jit->heat) {
+			log_fatal("jit_acquire(): Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		jit->decode = map->decode;
+		jit->size = map->rom_size;
+		jit->next = jits;
+		jits = jit;
+	}
+	jit->users++;
+	pthread_mutex_unlock(&jit_lock);
+	return jit;
+}
+
+void jit_release(jit_t *jit) {
+	if (!jit) {
+		return;
+	}
+	pthread_mutex_lock(&jit_lock);
+	if (--jit->users == 0) {
+		jit_t **link = &jits;
+		while (*link != jit) {
+			link = &(*link)->next;
+		}
+		*link = jit->next;
+		while (jit->all_blocks) {
+			block_t *b = jit->all_blocks;
+			jit->all_blocks = b->next;
+			free(b);
+		}
+		while (jit->chunks) {
+			chunk_t *c = jit->chunks;
+			jit->chunks = c->next;
+			munmap(c->mem, CHUNK_SIZE);
+			free(c);
+		}
+		free(jit->blocks);
+		free((void *)jit->heat);
+		free(jit);
+	}
+	pthread_mutex_unlock(&jit_lock);
+}
@@ -0,0 +1,28 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "emu.h"
+
+/* Experimental, x86-64 only, built with ENABLE_JIT. The code translated
+ * from a ROM image, shared by the consoles it is plugged into
+ */
+typedef struct jit_t jit_t;
+
+/* The translations for the cartridge plugged into emu, NULL if its code
+ * can not be translated
+ */
+jit_t *jit_acquire(emu_t *emu);
+/* Done with translations from jit_acquire() */
+void jit_release(jit_t *jit);
+
+/* Run as cpu_run() would. Hot blocks of ROM code run translated, the rest
+ * through the interpreter
+ */
+cycles_t jit_run(emu_t *emu, cycles_t budget);
+
+/* Called by the interpreter as control reaches pc, return whether to hand
+ * back to jit_run()
+ */
+_Bool jit_wants(emu_t *emu, addr_t pc);
+
+#endif
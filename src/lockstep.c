@@ -0,0 +1,321 @@
+#include <string.h>
+#include "lockstep.h"
+#include "cpu.h"
+#include "cpu_ops.h"
+#include "emu.h"
+#include "mspace.h"
+#include "pia.h"
+#include "tia.h"
+
+/*
+ * Lockstep Interpreter (experimental)
+ *
+ * Consoles running the same ROM spend much of their time running the same
+ * code. lockstep_run() keeps the registers of up to LOCKSTEP_LANES of them
+ * side by side, one console per lane. The lanes at the same PC, with the
+ * same banks switched in, form a group: an instruction is fetched and
+ * decoded once for the group and carried out for each of its lanes in
+ * turn, with the statements cpu_ops.h has for it.
+ *
+ * Only what no device can notice is done that way: register operations,
+ * branches, jumps and subroutine calls, and memory accesses that go
+ * straight to RAM or ROM. A lane whose instruction touches the TIA, the
+ * PIA or a bank switching hotspot has it carried out by cpu_run() instead,
+ * and so does every lane for code that is not in ROM, which may differ from
+ * lane to lane. Either way the lanes go on together with the next
+ * instruction.
+ *
+ * A branch that only some of the lanes take splits the group. The group
+ * run next is always that of the lane furthest behind in time, so lanes
+ * ahead wait for the others to catch up, and lanes that went their own way
+ * meet again at the same PC, usually right after the next WSYNC.
+ */
+
+typedef struct lockstep_t {
+	emu_t **emus;
+	/* Registers, P with all of its flags */
+	byte_t a[LOCKSTEP_LANES], x[LOCKSTEP_LANES], y[LOCKSTEP_LANES];
+	byte_t s[LOCKSTEP_LANES], p[LOCKSTEP_LANES];
+	addr_t pc[LOCKSTEP_LANES];
+	/* Cycle counter and the cycle to stop at, as in cpu_run() */
+	cycles_t clk[LOCKSTEP_LANES];
+	cycles_t end[LOCKSTEP_LANES];
+	/* Lanes that have not run out of budget, one bit each */
+	unsigned int active;
+} lockstep_t;
+
+/* Each lane l of the bit mask group, lowest first */
+#define EACH_LANE(l, group) \
+	for (unsigned int g_ = (group), l; g_ && (l = __builtin_ctz(g_), 1); g_ &= g_ - 1)
+
+/* Where addr is mapped, NULL if it goes through a handler */
+static const byte_t *read_ptr(const emu_t *emu, addr_t addr) {
+	const page_t *pg = &emu->mspace.page_tbl[(addr & ADDR_MASK) >> PAGE_SHIFT];
+	return pg->read ? pg->read + (addr & (PAGE_SIZE - 1)) : NULL;
+}
+
+static byte_t *write_ptr(const emu_t *emu, addr_t addr) {
+	const page_t *pg = &emu->mspace.page_tbl[(addr & ADDR_MASK) >> PAGE_SHIFT];
+	return pg->write ? pg->write + (addr & (PAGE_SIZE - 1)) : NULL;
+}
+
+static _Bool in_rom(const emu_t *emu, addr_t addr) {
+	const byte_t *p = read_ptr(emu, addr);
+	const cart_map_t *map = &emu->cart_map;
+	return p && p >= map->rom && p < map->rom + map->rom_size;
+}
+
+/* With the same ROM, the same banks mean the same memory map */
+static _Bool same_banks(const emu_t *a, const emu_t *b) {
+	return memcmp(a->machine.cart.bank, b->machine.cart.bank, sizeof(a->machine.cart.bank)) == 0 &&
+		a->machine.cart.fe_armed == b->machine.cart.fe_armed;
+}
+
+/* One instruction of lane l, through cpu_run() */
+static void step_scalar(lockstep_t *ls, int l) {
+	emu_t *emu = ls->emus[l];
+	cpu_t *cpu = &emu->machine.cpu;
+	cpu->A = ls->a[l];
+	cpu->X = ls->x[l];
+	cpu->Y = ls->y[l];
+	cpu->S = 0x0100 | ls->s[l];
+	cpu->P = ls->p[l];
+	cpu->PC = ls->pc[l];
+	cpu->machine_cycles = ls->clk[l];
+	cpu_run(emu, 1);
+	ls->a[l] = cpu->A;
+	ls->x[l] = cpu->X;
+	ls->y[l] = cpu->Y;
+	ls->s[l] = cpu->S;
+	ls->p[l] = cpu->P;
+	ls->pc[l] = cpu->PC;
+	ls->clk[l] = cpu->machine_cycles;
+	if (cpu->yield) {
+		ls->end[l] = ls->clk[l];
+	}
+}
+
+/* Writes an instruction makes, at most (BRK) */
+#define MAX_WRITES 3
+
+/* How an instruction is going for the lane it is carried out for */
+typedef struct lane_t {
+	/* An access went through a handler, cpu_run() has to do it */
+	_Bool bail;
+	/* Writes, held back until the instruction gets through. No
+	 * instruction reads what it wrote itself */
+	int nwrites;
+	byte_t *at[MAX_WRITES];
+	byte_t b[MAX_WRITES];
+} lane_t;
+
+static inline byte_t lane_read(const emu_t *emu, addr_t addr, lane_t *lane) {
+	const byte_t *p = read_ptr(emu, addr);
+	if (!p) {
+		lane->bail = 1;
+		return 0;
+	}
+	return *p;
+}
+
+static inline void lane_write(const emu_t *emu, addr_t addr, byte_t b, lane_t *lane) {
+	byte_t *p = write_ptr(emu, addr);
+	if (!p || lane->nwrites == MAX_WRITES) {
+		lane->bail = 1;
+		return;
+	}
+	lane->at[lane->nwrites] = p;
+	lane->b[lane->nwrites++] = b;
+}
+
+/* Write back what the instruction did for lane l, or if it could not be
+ * done here, have cpu_run() do it */
+static void finish_lane(lockstep_t *ls, int l, const lane_t *lane, byte_t a, byte_t x,
+		byte_t y, byte_t s, byte_t p, addr_t pc, cycles_t clk) {
+	if (lane->bail) {
+		step_scalar(ls, l);
+		return;
+	}
+	for (int i = 0; i < lane->nwrites; ++i) {
+		*lane->at[i] = lane->b[i];
+	}
+	ls->a[l] = a;
+	ls->x[l] = x;
+	ls->y[l] = y;
+	ls->s[l] = s;
+	ls->p[l] = p;
+	ls->pc[l] = pc;
+	ls->clk[l] = clk;
+}
+
+/*
+ * The statements of cpu_ops.h operate on the locals of step_group(), which
+ * holds a lane's registers while it runs an instruction for it. Memory goes
+ * straight to the page table, or bails the lane out. As with the memory
+ * cpu_run() reaches directly, nothing there moves the clock or yields.
+ * Control transfers need no attention: every lane goes back to the loop in
+ * lockstep_run() after each instruction.
+ */
+#undef READ
+#undef WRITE
+#define READ(addr) lane_read(emu, (addr), &lane)
+#define WRITE(addr, b) lane_write(emu, (addr), (b), &lane)
+#define JUMPED() do { } while (0)
+
+/* One case of the switch in step_group(), the instruction for each lane */
+#define LANE_CASE(opcode, statements) \
+	case opcode: \
+		EACH_LANE(l, group) { \
+			emu = ls->emus[l]; \
+			a = ls->a[l]; \
+			x = ls->x[l]; \
+			y = ls->y[l]; \
+			s = ls->s[l]; \
+			SET_FLAGS(ls->p[l]); \
+			pc = first + inst_bytes(opcode); \
+			clk = ls->clk[l] + inst_cycles(opcode); \
+			lane.bail = 0; \
+			lane.nwrites = 0; \
+			statements; \
+			finish_lane(ls, l, &lane, a, x, y, s, FLAGS(), pc, clk); \
+		} \
+		break;
+
+/* Carry out the instruction at the leader's PC for every lane of group */
+static void step_group(lockstep_t *ls, int leader, unsigned int group) {
+	const emu_t *lead = ls->emus[leader];
+	const addr_t first = ls->pc[leader];
+	if (!in_rom(lead, first) || !in_rom(lead, first + 2)) {
+		EACH_LANE(l, group) {
+			step_scalar(ls, l);
+		}
+		return;
+	}
+	const byte_t opcode = *read_ptr(lead, first);
+	const addr_t operand = *read_ptr(lead, first + 1) | (*read_ptr(lead, first + 2) << 8);
+
+	emu_t *emu;
+	byte_t a, x, y, s, p, n, z, c;
+	addr_t pc;
+	addr_t ea = 0;
+	cycles_t clk;
+	lane_t lane;
+
+	switch (opcode) {
+		CPU_OPS(LANE_CASE)
+
+		default:
+			/* Vacant, cpu_run() reports those */
+			EACH_LANE(l, group) {
+				step_scalar(ls, l);
+			}
+			break;
+	}
+}
+
+void lockstep_run(emu_t **emus, int n, const cycles_t *budgets) {
+	lockstep_t ls;
+	memset(&ls, 0, sizeof(ls));
+	ls.emus = emus;
+	for (int l = 0; l < n; ++l) {
+		emu_t *emu = emus[l];
+		if (!emu->machine.cpu.running) {
+			continue;
+		}
+		ls.a[l] = fetch_A(emu);
+		ls.x[l] = fetch_X(emu);
+		ls.y[l] = fetch_Y(emu);
+		ls.s[l] = fetch_S(emu);
+		ls.p[l] = fetch_P(emu);
+		ls.pc[l] = fetch_PC(emu);
+		ls.clk[l] = emu->machine.cpu.machine_cycles;
+		ls.end[l] = ls.clk[l] + budgets[l];
+		emu->machine.cpu.yield = 0;
+		if ((scycles_t)(ls.end[l] - ls.clk[l]) > 0) {
+			ls.active |= 1u << l;
+		}
+	}
+	const unsigned int ran = ls.active;
+
+	unsigned int group = 0;
+	int leader = 0;
+	while (ls.active) {
+		if (!group) {
+			/* The lane furthest behind leads */
+			leader = __builtin_ctz(ls.active);
+			EACH_LANE(l, ls.active) {
+				if ((scycles_t)(ls.clk[l] - ls.clk[leader]) < 0) {
+					leader = l;
+				}
+			}
+			EACH_LANE(l, ls.active) {
+				if (ls.pc[l] == ls.pc[leader] && same_banks(emus[l], emus[leader])) {
+					group |= 1u << l;
+				}
+			}
+		}
+
+		/* The group stays together until its lanes part ways or one of
+		 * them is done */
+		_Bool together = 1;
+		step_group(&ls, leader, group);
+		EACH_LANE(l, group) {
+			if ((scycles_t)(ls.end[l] - ls.clk[l]) <= 0) {
+				ls.active &= ~(1u << l);
+				together = 0;
+			}
+			else if (ls.pc[l] != ls.pc[leader]) {
+				together = 0;
+			}
+		}
+		if (!together) {
+			group = 0;
+		}
+	}
+
+	EACH_LANE(l, ran) {
+		emu_t *emu = emus[l];
+		set_A(emu, ls.a[l]);
+		set_X(emu, ls.x[l]);
+		set_Y(emu, ls.y[l]);
+		set_S(emu, 0x0100 | ls.s[l]);
+		set_P(emu, ls.p[l]);
+		set_PC(emu, ls.pc[l]);
+		emu->machine.cpu.machine_cycles = ls.clk[l];
+	}
+}
+
+void lockstep_step_frame(emu_t **emus, int n) {
+	cycles_t start[LOCKSTEP_LANES];
+	unsigned int pending = 0;
+	for (int i = 0; i < n; ++i) {
+		start[i] = fetch_machine_cycles(emus[i]);
+		if (!tia_frame_done(emus[i])) {
+			pending |= 1u << i;
+		}
+	}
+	while (pending) {
+		emu_t *run[LOCKSTEP_LANES];
+		cycles_t budgets[LOCKSTEP_LANES];
+		int k = 0;
+		EACH_LANE(i, pending) {
+			/* If CPU is halted, let the time pass */
+			if (!cpu_fetch_status(emus[i])) {
+				cnt_machine_cycles(emus[i], tia_frame_budget(emus[i]));
+				continue;
+			}
+			run[k] = emus[i];
+			budgets[k++] = tia_frame_budget(emus[i]);
+		}
+		lockstep_run(run, k, budgets);
+		EACH_LANE(i, pending) {
+			tia_sync(emus[i]);
+			if (tia_frame_done(emus[i])) {
+				pending &= ~(1u << i);
+			}
+		}
+	}
+	for (int i = 0; i < n; ++i) {
+		cnt_pia_cycles(emus[i], fetch_machine_cycles(emus[i]) - start[i]);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "emu.h"
+
+/* Consoles run together by the lockstep interpreter, at most */
+#define LOCKSTEP_LANES 16
+
+/* Experimental. Run each of the n consoles, which must have the same ROM
+ * plugged in, as cpu_run(emus[i], budgets[i]) would
+ */
+void lockstep_run(emu_t **emus, int n, const cycles_t *budgets);
+
+/* Run each of the n consoles until its TIA has finished a frame, as
+ * emu_step_frame() would
+ */
+void lockstep_step_frame(emu_t **emus, int n);
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lockstep.h"
+#include "pia.h"
+#include "tia.h"
+#include "log.h"
+#include "test_rom.h"
+
+/*
+ * Checks that lockstep_step_frame() runs each console as emu_step_frame()
+ * would on its own, with cpu_run(): after every frame the whole machine
+ * state and the picture have to be the same. Each console has controls of
+ * its own, which change as the frames go, so the lanes part ways and meet
+ * again all the time.
+ */
+
+#define NFRAMES 300
+
+static uint16_t action(int frame, int i) {
+	uint32_t h = (uint32_t)(frame / 8 + 1) * 2654435761u ^ (uint32_t)i * 40503u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995;
+	h ^= h >> 15;
+	return h & 0x03ff;
+}
+
+static void set_controls(emu_t *emu, uint16_t action) {
+	pia_set_joysticks(emu, action & 0xff);
+	tia_set_fire(emu, action >> 8);
+}
+
+static int check_lanes(char *rom, int n) {
+	emu_t *want[LOCKSTEP_LANES], *got[LOCKSTEP_LANES];
+	for (int i = 0; i < n; ++i) {
+		want[i] = emu_new(rom, &null_backend);
+		got[i] = emu_new(rom, &null_backend);
+	}
+	size_t size = emu_state_size(want[0]);
+	byte_t *want_state = malloc(size);
+	byte_t *got_state = malloc(size);
+	int errors = 0;
+
+	for (int f = 0; f < NFRAMES; ++f) {
+		for (int i = 0; i < n; ++i) {
+			set_controls(want[i], action(f, i));
+			set_controls(got[i], action(f, i));
+			emu_step_frame(want[i]);
+		}
+		lockstep_step_frame(got, n);
+		for (int i = 0; i < n; ++i) {
+			emu_save(want[i], want_state);
+			emu_save(got[i], got_state);
+			if ((memcmp(want_state, got_state, size) ||
+						memcmp(tia_frame(want[i]), tia_frame(got[i]), VISIBLE_WIDTH * VISIBLE_HEIGHT)) &&
+					errors++ == 0) {
+				printf("%d lanes: console %d differs at frame %d\n", n, i, f);
+			}
+		}
+	}
+
+	for (int i = 0; i < n; ++i) {
+		emu_free(want[i]);
+		emu_free(got[i]);
+	}
+	free(want_state);
+	free(got_state);
+	printf("%d lanes: %d mismatches\n", n, errors);
+	return errors;
+}
+
+int main() {
+	log_set_quiet(1);
+	char *rom = test_rom_file();
+	int errors = check_lanes(rom, 1) + check_lanes(rom, 5) + check_lanes(rom, LOCKSTEP_LANES);
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,128 +2,255 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mspace.h"
+#include "emu.h"
 #include "log.h"
 #include "except.h"
 #include "tia.h"
+#include "pia.h"
+#include "romdb.h"
 
 
-/* The Address/Memory Space accessible to the CPU */
-static byte_t mspace[0xffff];
+/*
+ * Memory Map
+ *
+ * The 6507 only has 13 address lines, every address is masked down to
+ * 0x0000-0x1fff and whatever lies above is a mirror. The chips are selected
+ * by three of the lines:
+ *
+ * A12 = 1                   Cartridge
+ * A12 = 0, A7 = 0           TIA
+ * A12 = 0, A7 = 1, A9 = 0   RIOT RAM, 128 bytes
+ * A12 = 0, A7 = 1, A9 = 1   RIOT ports and timer
+ *
+ * None of these lines is below A6, so the address space is cut in pages of
+ * 64 bytes, and the page_tbl of each console says what is behind each of them. A page is either
+ * backed by memory, which is then read or written directly, or by a device,
+ * whose handler is called. Reads and writes are mapped separately, so that
+ * a ROM page can be read directly and still have writes go to a handler.
+ *
+ * Handlers get the address as the CPU put it out, before masking, as some
+ * cartridges look at the lines above A12.
+ */
 
-/* CPU Registers */
+void mspace_map(emu_t *emu, addr_t start, addr_t size, byte_t *read, byte_t *write) {
+	for (addr_t offset = 0; offset < size; offset += PAGE_SIZE) {
+		page_t *p = &emu->mspace.page_tbl[((start + offset) & ADDR_MASK) >> PAGE_SHIFT];
+		p->read = read ? read + offset : NULL;
+		p->write = write ? write + offset : NULL;
+	}
+}
+
+void mspace_map_handlers(emu_t *emu, addr_t start, addr_t size, read_handler_t read,
+		write_handler_t write) {
+	for (addr_t offset = 0; offset < size; offset += PAGE_SIZE) {
+		page_t *p = &emu->mspace.page_tbl[((start + offset) & ADDR_MASK) >> PAGE_SHIFT];
+		p->read_handler = read;
+		p->write_handler = write;
+	}
+}
 
-static byte_t A;			/* Accumulator */
-static byte_t X;			/* General Purpose Register X */	
-static byte_t Y;			/* General Purpose Register X */	
-static addr_t S = RAM_END;	/* Stack Pointer */
-static byte_t P = 32;		/* Program Status Word. 32 bcoz the 5th bit
-							   is supposed to be logical 1 at all times */
-static addr_t PC;			/* Program Counter */
+byte_t *mspace_ram(emu_t *emu) {
+	return emu->machine.ram;
+}
+
+void mspace_init(emu_t *emu) {
+	byte_t *ram = emu->machine.ram;
+	for (addr_t base = 0; base <= ADDR_MASK; base += PAGE_SIZE) {
+		/* The cartridge space is left to cart_insert() */
+		if (base & 0x1000) {
+			continue;
+		}
+		if (!(base & 0x0080)) {
+			mspace_map_handlers(emu, base, PAGE_SIZE, tia_read, tia_write);
+			mspace_map(emu, base, PAGE_SIZE, NULL, NULL);
+		}
+		else if (!(base & 0x0200)) {
+			mspace_map(emu, base, PAGE_SIZE, ram + (base & 0x0040), ram + (base & 0x0040));
+		}
+		else {
+			mspace_map_handlers(emu, base, PAGE_SIZE, pia_read, pia_write);
+			mspace_map(emu, base, PAGE_SIZE, NULL, NULL);
+		}
+	}
+	emu->machine.cpu.S = RAM_END;
+	/* 32 bcoz the 5th bit is supposed to be logical 1 at all times */
+	emu->machine.cpu.P = 32;
+	log_trace("Initialized Memory Map");
+}
 
-byte_t fetch_byte(addr_t addr) {
-	return mspace[addr];
+byte_t fetch_byte(emu_t *emu, addr_t addr) {
+	const page_t *p = &emu->mspace.page_tbl[(addr & ADDR_MASK) >> PAGE_SHIFT];
+	if (p->read) {
+		return p->read[addr & (PAGE_SIZE - 1)];
+	}
+	return p->read_handler(emu, addr);
 }
+
 /* Set addr to b */
-void set_byte(addr_t addr, byte_t b) {
-	if (is_strobe(addr)) {
-		strobe_dispatch(addr, b);
+void set_byte(emu_t *emu, addr_t addr, byte_t b) {
+	const page_t *p = &emu->mspace.page_tbl[(addr & ADDR_MASK) >> PAGE_SHIFT];
+	if (p->write) {
+		p->write[addr & (PAGE_SIZE - 1)] = b;
+		return;
 	}
-	mspace[addr] = b;
+	p->write_handler(emu, addr, b);
 }
 
-void set_PC(addr_t addr) {
-	PC = addr;
+/* CPU Registers */
+
+void set_PC(emu_t *emu, addr_t addr) {
+	emu->machine.cpu.PC = addr;
 }
 
-addr_t fetch_PC() {
-	return PC;
+addr_t fetch_PC(emu_t *emu) {
+	return emu->machine.cpu.PC;
 }
 
-void set_A(byte_t b) {
-	A = b;
+void set_A(emu_t *emu, byte_t b) {
+	emu->machine.cpu.A = b;
 }
-byte_t fetch_A() {
-	return A;
+byte_t fetch_A(emu_t *emu) {
+	return emu->machine.cpu.A;
 }
 
-void set_X(byte_t b) {
-	X = b;
+void set_X(emu_t *emu, byte_t b) {
+	emu->machine.cpu.X = b;
 }
-byte_t fetch_X() {
-	return X;
+byte_t fetch_X(emu_t *emu) {
+	return emu->machine.cpu.X;
 }
 
-void set_Y(byte_t b) {
-	Y = b;
+void set_Y(emu_t *emu, byte_t b) {
+	emu->machine.cpu.Y = b;
 }
 
-byte_t fetch_Y() {
-	return Y;
+byte_t fetch_Y(emu_t *emu) {
+	return emu->machine.cpu.Y;
 }
 
-void set_S(addr_t b) {
-	S = b;
+void set_S(emu_t *emu, addr_t b) {
+	emu->machine.cpu.S = b;
 }
-addr_t fetch_S() {
-	return S;
+addr_t fetch_S(emu_t *emu) {
+	return emu->machine.cpu.S;
 }
 
-void set_P(byte_t b) {
-	P = b;
+void set_P(emu_t *emu, byte_t b) {
+	emu->machine.cpu.P = b;
 }
 
-byte_t fetch_P() {
-	return P;
+byte_t fetch_P(emu_t *emu) {
+	return emu->machine.cpu.P;
 }
 
-void set_STATUS(enum status_t st) {
-	P |= st;
+void set_STATUS(emu_t *emu, enum status_t st) {
+	emu->machine.cpu.P |= st;
 }
 
-void clear_STATUS(enum status_t st) {
-	P &= (~st);
+void clear_STATUS(emu_t *emu, enum status_t st) {
+	emu->machine.cpu.P &= (~st);
 }
 
-byte_t fetch_STATUS(enum status_t st) {
-	return ((P & st) == 0 ? 0 : 1);
+byte_t fetch_STATUS(emu_t *emu, enum status_t st) {
+	return ((emu->machine.cpu.P & st) == 0 ? 0 : 1);
 }
 
 // TODO: Check for stack overflow
-void stack_push(byte_t b) {
-	mspace[S] = b;
-	S--;
+void stack_push(emu_t *emu, byte_t b) {
+	set_byte(emu, emu->machine.cpu.S, b);
+	emu->machine.cpu.S--;
+}
+
+byte_t stack_pop(emu_t *emu) {
+	emu->machine.cpu.S++;
+	return fetch_byte(emu, emu->machine.cpu.S);
 }
 
-byte_t stack_pop() {
-	S++;
-	return mspace[S];
+byte_t stack_top(emu_t *emu) {
+	return fetch_byte(emu, emu->machine.cpu.S + 1);
 }
 
-byte_t stack_top() {
-	return mspace[S+1];
+/* Read what cannot be mapped, pipes and the like. hint is the size fstat()
+ * gave, if any, so that a regular file is read in one go. Otherwise the
+ * buffer is doubled whenever it fills up */
+static byte_t *read_cartridge(int fd, char *filename, size_t hint, size_t *size) {
+	size_t capacity = hint ? hint + 1 : 0x1000;
+	byte_t *rom = malloc(capacity);
+	*size = 0;
+	for (;;) {
+		if (!rom) {
+			log_fatal("%s: %s\n", filename, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		ssize_t n = read(fd, rom + *size, capacity - *size);
+		if (n < 0) {
+			log_fatal("%s: %s\n", filename, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) {
+			return rom;
+		}
+		*size += n;
+		if (*size == capacity) {
+			capacity *= 2;
+			rom = realloc(rom, capacity);
+		}
+	}
 }
 
-void load_cartridge(char *filename) {
-	FILE *fp = fopen(filename, "r");
-	if (!fp) {
+/* The image is mapped read-only and shared, so every emulator running the
+ * same ROM uses the same physical copy, and nothing is read from the file
+ * until the cartridge gets to it.
+ */
+void load_cartridge(emu_t *emu, char *filename) {
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
 		log_fatal("%s: %s\n", filename, strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	const int cart_size = CARMEM_END - CARMEM_START;
-	byte_t tbuf[cart_size];
-	int read_size = fread(tbuf, sizeof(byte_t), cart_size, fp);
-	memcpy(mspace + CARMEM_START, tbuf, read_size);
+	size_t size = st.st_size;
+	byte_t *rom = MAP_FAILED;
+	if (S_ISREG(st.st_mode) && size > 0) {
+		rom = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	if (rom == MAP_FAILED) {
+		rom = read_cartridge(fd, filename, S_ISREG(st.st_mode) ? size : 0, &size);
+	}
+	else {
+		emu->mspace.rom_mapped = 1;
+	}
+	close(fd);
+	emu->mspace.rom = rom;
+	emu->mspace.rom_size = size;
+	rom_info_t info = romdb_identify(rom, size);
+	cart_insert(emu, rom, size, info.cart);
 	log_trace("load_cartridge(): Loaded Cartridge Into Memory");
-	fclose(fp);
 
-	addr_t l = fetch_byte(CARMEM_END - 3);
-	addr_t h = fetch_byte(CARMEM_END - 2);
+	addr_t l = fetch_byte(emu, CARMEM_END - 3);
+	addr_t h = fetch_byte(emu, CARMEM_END - 2);
 	addr_t cart_entrypoint = (h << 8) + l;
-	if (cart_entrypoint < CARMEM_START) {
+	/* Anywhere with A12 set is the cartridge */
+	if (!(cart_entrypoint & 0x1000)) {
 		cart_entrypoint = CARMEM_START;
 	}
-	set_PC(cart_entrypoint);
+	set_PC(emu, cart_entrypoint);
+}
+
+void unload_cartridge(emu_t *emu) {
+	if (emu->mspace.rom_mapped) {
+		munmap(emu->mspace.rom, emu->mspace.rom_size);
+	}
+	else {
+		free(emu->mspace.rom);
+	}
+	emu->mspace.rom = NULL;
+	emu->mspace.rom_mapped = 0;
 }
 
 int p2(int n) {
@@ -1,6 +1,7 @@
 #ifndef MSPACE_H
 #define MSPACE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* Width of the data bus */
@@ -8,6 +9,9 @@ typedef uint8_t byte_t;
 /* Width of the address bus */
 typedef uint16_t addr_t;
 
+/* A console, see emu.h */
+typedef struct emu_t emu_t;
+
 /* Used by cycle counters */
 typedef uint32_t cycles_t;
 /* Signed cycles_t */
@@ -20,12 +24,16 @@ typedef int32_t scycles_t;
  * 0080-00FF  PIA RAM (128 bytes)
  * 0280-0297  PIA Ports and Timer
  * F000-FFFF  Cartridge Memory (4 Kbytes area)
+ * Only 13 of the address lines reach the bus, see mspace.c
  */
 
 /* Cartridge Memory Boundaries */
 #define CARMEM_START 0xf000
 #define CARMEM_END 0xffff
 
+/* The 6507 has 13 address lines, addresses are masked with this */
+#define ADDR_MASK 0x1fff
+
 #define RAM_START 0x0180
 #define RAM_END 0x01ff
 
@@ -121,38 +129,82 @@ enum status_t {
  * 				Functions                 *
  ******************************************/
 
-/* Return the byte at addr from mspace[] */
-byte_t fetch_byte(addr_t addr);
-/* Set addr to b in mspace[] */
-void set_byte(addr_t addr, byte_t b);
+/* Devices are read and written through these */
+typedef byte_t (*read_handler_t)(emu_t *emu, addr_t addr);
+typedef void (*write_handler_t)(emu_t *emu, addr_t addr, byte_t b);
+
+/* The address space is cut in pages of 64 bytes, see mspace.c */
+#define PAGE_SHIFT 6
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define NPAGES ((ADDR_MASK + 1) >> PAGE_SHIFT)
+
+typedef struct page_t {
+	byte_t *read;			/* Memory backing reads, NULL to call read_handler */
+	byte_t *write;			/* Memory backing writes, NULL to call write_handler */
+	read_handler_t read_handler;
+	write_handler_t write_handler;
+} page_t;
+
+/* The memory map of a console. It is worked out from the cartridge and its
+ * bank switching state, and is not part of the machine state
+ */
+typedef struct mspace_t {
+	page_t page_tbl[NPAGES];
+	/* The cartridge image, as loaded by load_cartridge() */
+	byte_t *rom;
+	size_t rom_size;
+	_Bool rom_mapped;	/* mmap()ed rather than read into the heap */
+} mspace_t;
+
+/* Set up the memory map, all but the cartridge, see cart_insert() */
+void mspace_init(emu_t *emu);
+/* The 128 bytes of RIOT RAM */
+byte_t *mspace_ram(emu_t *emu);
+/* Back size bytes from start with memory, reads from read and writes to
+ * write. A NULL pointer leaves the access to the page's handler. start and
+ * size are multiples of 64
+ */
+void mspace_map(emu_t *emu, addr_t start, addr_t size, byte_t *read, byte_t *write);
+/* Handlers for the accesses not backed by memory, from start on. They are
+ * passed the unmasked address
+ */
+void mspace_map_handlers(emu_t *emu, addr_t start, addr_t size, read_handler_t read,
+		write_handler_t write);
+
+/* Return the byte at addr */
+byte_t fetch_byte(emu_t *emu, addr_t addr);
+/* Set addr to b */
+void set_byte(emu_t *emu, addr_t addr, byte_t b);
 
-void set_PC(addr_t addr);
-addr_t fetch_PC();
+void set_PC(emu_t *emu, addr_t addr);
+addr_t fetch_PC(emu_t *emu);
 
-void set_A(byte_t b);
-byte_t fetch_A();
+void set_A(emu_t *emu, byte_t b);
+byte_t fetch_A(emu_t *emu);
 
-void set_X(byte_t b);
-byte_t fetch_X();
+void set_X(emu_t *emu, byte_t b);
+byte_t fetch_X(emu_t *emu);
 
-void set_Y(byte_t b);
-byte_t fetch_Y();
+void set_Y(emu_t *emu, byte_t b);
+byte_t fetch_Y(emu_t *emu);
 
-void set_S(addr_t b);
-addr_t fetch_S();
+void set_S(emu_t *emu, addr_t b);
+addr_t fetch_S(emu_t *emu);
 
-void set_P(byte_t b);
-byte_t fetch_P();
+void set_P(emu_t *emu, byte_t b);
+byte_t fetch_P(emu_t *emu);
 
-void set_STATUS(enum status_t st);
-byte_t fetch_STATUS(enum status_t st);
-void clear_STATUS(enum status_t st);
+void set_STATUS(emu_t *emu, enum status_t st);
+byte_t fetch_STATUS(emu_t *emu, enum status_t st);
+void clear_STATUS(emu_t *emu, enum status_t st);
 
-void stack_push(byte_t b);
-byte_t stack_pop();
-byte_t stack_top();
+void stack_push(emu_t *emu, byte_t b);
+byte_t stack_pop(emu_t *emu);
+byte_t stack_top(emu_t *emu);
 
-void load_cartridge(char *filename);
+void load_cartridge(emu_t *emu, char *filename);
+/* Release the image loaded by load_cartridge() */
+void unload_cartridge(emu_t *emu);
 
 int p2(int n);
 
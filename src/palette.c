@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include "palette.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PALETTE_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Palette Conversion
+ *
+ * The TIA draws color indices, a byte per pixel, and a frame is converted
+ * to whatever the consumer wants only once it is complete. Each format has
+ * a table with the value of every color index, widened to 32 bits for the
+ * narrower formats so that all of them can be looked up the same way.
+ *
+ * The AVX2 version looks up 8 pixels at a time with a gather, and packs the
+ * results down for the 16 and 8 bit formats. There is nothing in SSE2 to
+ * gather with, so other CPUs get the scalar version.
+ */
+
+#define NFORMATS 4
+
+static uint32_t tables[NFORMATS][256];
+
+int palette_pixel_size(enum pixel_format fmt) {
+	switch (fmt) {
+		case PIXEL_RGB565:
+			return 2;
+		case PIXEL_GRAY8:
+			return 1;
+		default:
+			return 4;
+	}
+}
+
+void palette_convert_scalar(void *dst, int pitch, const byte_t *src, int width, int height,
+		enum pixel_format fmt) {
+	const uint32_t *tbl = tables[fmt];
+	for (int y = 0; y < height; ++y) {
+		const byte_t *s = src + y * width;
+		byte_t *d = (byte_t *)dst + y * pitch;
+		switch (palette_pixel_size(fmt)) {
+			case 4:
+				for (int x = 0; x < width; ++x) {
+					((uint32_t *)d)[x] = tbl[s[x]];
+				}
+				break;
+			case 2:
+				for (int x = 0; x < width; ++x) {
+					((uint16_t *)d)[x] = tbl[s[x]];
+				}
+				break;
+			default:
+				for (int x = 0; x < width; ++x) {
+					d[x] = tbl[s[x]];
+				}
+				break;
+		}
+	}
+}
+
+#ifdef PALETTE_X86
+
+/* 32 pixels per iteration */
+__attribute__((target("avx2")))
+static void palette_convert_avx2(void *dst, int pitch, const byte_t *src, int width, int height,
+		enum pixel_format fmt) {
+	const int *tbl = (const int *)tables[fmt];
+	/* Dwords of the 8 bit packs, put back in pixel order */
+	const __m256i order8 = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	for (int y = 0; y < height; ++y) {
+		const byte_t *s = src + y * width;
+		byte_t *d = (byte_t *)dst + y * pitch;
+		for (int x = 0; x < width; x += 32) {
+			__m256i v[4];
+			for (int i = 0; i < 4; ++i) {
+				__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(s + x + 8 * i)));
+				v[i] = _mm256_i32gather_epi32(tbl, idx, 4);
+			}
+			switch (fmt) {
+				case PIXEL_RGB565: {
+					/* Packs work within 128 bit lanes, hence the permutes */
+					__m256i lo = _mm256_permute4x64_epi64(_mm256_packus_epi32(v[0], v[1]), 0xd8);
+					__m256i hi = _mm256_permute4x64_epi64(_mm256_packus_epi32(v[2], v[3]), 0xd8);
+					_mm256_storeu_si256((__m256i *)(d + 2 * x), lo);
+					_mm256_storeu_si256((__m256i *)(d + 2 * x + 32), hi);
+					break;
+				}
+				case PIXEL_GRAY8: {
+					__m256i lo = _mm256_packus_epi32(v[0], v[1]);
+					__m256i hi = _mm256_packus_epi32(v[2], v[3]);
+					__m256i g = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order8);
+					_mm256_storeu_si256((__m256i *)(d + x), g);
+					break;
+				}
+				default:
+					for (int i = 0; i < 4; ++i) {
+						_mm256_storeu_si256((__m256i *)(d + 4 * (x + 8 * i)), v[i]);
+					}
+					break;
+			}
+		}
+	}
+}
+
+#endif
+
+typedef void (*convert_fn)(void *, int, const byte_t *, int, int, enum pixel_format);
+static convert_fn convert = palette_convert_scalar;
+
+static void palette_select() {
+#ifdef PALETTE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		convert = palette_convert_avx2;
+		log_trace("Palette conversion: AVX2");
+		return;
+	}
+#endif
+	log_trace("Palette conversion: scalar");
+}
+
+void palette_init(const uint32_t colors[256]) {
+	for (int i = 0; i < 256; ++i) {
+		uint32_t c = colors[i];
+		uint32_t r = (c >> 24) & 0xff;
+		uint32_t g = (c >> 16) & 0xff;
+		uint32_t b = (c >> 8) & 0xff;
+		tables[PIXEL_RGBA8888][i] = c;
+		tables[PIXEL_XRGB8888][i] = c >> 8;
+		tables[PIXEL_RGB565][i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+		tables[PIXEL_GRAY8][i] = (r * 77 + g * 150 + b * 29) >> 8;
+	}
+	palette_select();
+}
+
+void palette_convert(void *dst, int pitch, const byte_t *src, int width, int height,
+		enum pixel_format fmt) {
+	convert(dst, pitch, src, width, height, fmt);
+}
@@ -0,0 +1,34 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+#include "mspace.h"
+
+/* Formats the indexed frame can be converted to */
+enum pixel_format {
+	PIXEL_RGBA8888,		/* 32 bits, 0xRRGGBBAA */
+	PIXEL_XRGB8888,		/* 32 bits, 0x00RRGGBB */
+	PIXEL_RGB565,		/* 16 bits */
+	PIXEL_GRAY8		/* 8 bits, luminance */
+};
+
+/* Build the conversion tables from the RGBA8888 colors of the 256
+ * color indices, and pick the fastest palette_convert() this CPU can run
+ */
+void palette_init(const uint32_t colors[256]);
+
+/* Bytes taken by a pixel in fmt */
+int palette_pixel_size(enum pixel_format fmt);
+
+/* Convert width x height color indices, stored row after row, to fmt.
+ * pitch is the number of bytes from one row of dst to the next. width must
+ * be a multiple of 32.
+ */
+void palette_convert(void *dst, int pitch, const byte_t *src, int width, int height,
+		enum pixel_format fmt);
+
+/* The portable version, the others must give the same results */
+void palette_convert_scalar(void *dst, int pitch, const byte_t *src, int width, int height,
+		enum pixel_format fmt);
+
+#endif
@@ -1,98 +1,97 @@
-#include <SDL2/SDL.h>
 #include "mspace.h"
 #include "pia.h"
+#include "cpu.h"
+#include "emu.h"
 
-static cycles_t PIA_CYCLES = 0;
+/* The timer is not counted down as the machine runs. set_timer() records
+ * the machine cycle it was started on, and fetch_timer() works out what
+ * INTIM reads at the current cycle.
+ */
+static void set_timer(emu_t *emu, byte_t intervals, uint32_t number) {
+	pia_t *pia = &emu->machine.pia;
+	pia->timer_start = fetch_machine_cycles(emu);
+	pia->timer_intervals = intervals;
+	pia->timer_number = number;
+}
 
-static cycles_t timer_cycles = 0;
-static uint32_t timer_number = 1;
+static byte_t fetch_timer(emu_t *emu) {
+	const pia_t *pia = &emu->machine.pia;
+	cycles_t elapsed = fetch_machine_cycles(emu) - pia->timer_start;
+	scycles_t remaining = (scycles_t)(pia->timer_intervals * pia->timer_number) - (scycles_t)elapsed;
+	if (remaining >= 0) {
+		return remaining / pia->timer_number;
+	}
+	/* Once the timer has run out it keeps counting down from 0xff, one
+	 * decrement per cycle
+	 */
+	return remaining & 0xff;
+}
 
-void set_timer(byte_t intervals, uint32_t number) {
-	set_byte(INTIM, intervals);
-	timer_number = number;
-	timer_cycles = intervals * number;
+/* Timer expired, read from TIMINT */
+static byte_t fetch_timer_flag(emu_t *emu) {
+	const pia_t *pia = &emu->machine.pia;
+	cycles_t elapsed = fetch_machine_cycles(emu) - pia->timer_start;
+	return elapsed > (cycles_t)(pia->timer_intervals * pia->timer_number) ? 0x80 : 0x00;
 }
 
-void cnt_timer(cycles_t cycles) {
-	byte_t interval = fetch_byte(INTIM);
-	if (interval <= 0) {
-		return;
-	}
-	if ((scycles_t)timer_cycles - (scycles_t)cycles < 0) {
-		goto dec_interval;
-	}
-	timer_cycles -= cycles;
-	if ((timer_cycles % timer_number) == 0) {
-		goto dec_interval;
+void cnt_pia_cycles(emu_t *emu, cycles_t cycles) {
+	emu->machine.pia.pia_cycles += cycles;
+}
+
+void pia_init(emu_t *emu) {
+	pia_t *pia = &emu->machine.pia;
+	pia->pia_cycles = 0;
+	pia->timer_start = 0;
+	pia->timer_intervals = 0;
+	pia->timer_number = 1;
+	/* Ports: no joystick direction or console switch pressed, color TV */
+	pia->swcha = 0xff;
+	pia->swacnt = 0x00;
+	pia->swchb = 0x0b;
+}
+
+/*
+ * Addresses
+ *
+ * Reads:  A2 = 0 selects the ports (A0, A1 pick SWCHA, SWACNT, SWCHB,
+ *         SWBCNT), otherwise A0 = 0 is INTIM, A0 = 1 TIMINT
+ * Writes: A2 = 0 selects the ports, A2 = 1 and A4 = 1 start the timer,
+ *         with A0, A1 selecting the interval
+ */
+
+byte_t pia_read(emu_t *emu, addr_t addr) {
+	if (!(addr & 0x04)) {
+		switch (addr & 0x03) {
+			case 0:
+				return emu->machine.pia.swcha;
+			case 1:
+				return emu->machine.pia.swacnt;
+			case 2:
+				return emu->machine.pia.swchb;
+			default:
+				return 0x00;
+		}
 	}
-	return;
+	return (addr & 0x01) ? fetch_timer_flag(emu) : fetch_timer(emu);
+}
 
-dec_interval:
-		interval--;
-		if (interval == 0) {
-			set_STATUS(STATUS_Z);
+void pia_write(emu_t *emu, addr_t addr, byte_t b) {
+	static const uint32_t intervals[4] = { 1, 8, 64, 1024 };
+	if (!(addr & 0x04)) {
+		/* The ports themselves are only driven by the input devices */
+		if ((addr & 0x03) == 1) {
+			emu->machine.pia.swacnt = b;
 		}
-		set_byte(INTIM, interval);
+	}
+	else if (addr & 0x10) {
+		set_timer(emu, b, intervals[addr & 0x03]);
+	}
 }
 
-void cnt_pia_cycles(cycles_t cycles) {
-	PIA_CYCLES += cycles;
-	cnt_timer(cycles);
+void pia_process_input(emu_t *emu, enum joystick_t j) {
+	pia_set_joysticks(emu, (byte_t)(1u << j));
 }
 
-void pia_process_input(int code) {
-	int tmp = 0;
-	switch (code) {
-		case SDL_SCANCODE_W:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 4);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_A:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 6);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_S:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 5);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_D:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 7);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_UP:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 0);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_LEFT:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 2);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_DOWN:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 1);
-			set_byte(SWCHA, tmp);
-			break;
-		case SDL_SCANCODE_RIGHT:
-			set_byte(SWCHA, 0xff);
-			tmp = fetch_byte(SWCHA);
-			clear_bit(tmp, 3);
-			set_byte(SWCHA, tmp);
-			break;
-		default:
-			break;
-	}
-	printf("%02x\n", fetch_byte(SWCHA));
+void pia_set_joysticks(emu_t *emu, byte_t pressed) {
+	emu->machine.pia.swcha = ~pressed;
 }
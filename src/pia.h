@@ -2,9 +2,42 @@
 #define PIA_H
 
 #include <stdint.h>
+#include "mspace.h"
 
-void pia_process_input(int code);
-void cnt_pia_cycles(uint32_t cycles);
-void set_timer(byte_t intervals, uint32_t number);
+/* Joystick switches, as the bit of SWCHA that reads 0 while pressed */
+enum joystick_t {
+	P1_UP = 0,
+	P1_DOWN,
+	P1_LEFT,
+	P1_RIGHT,
+	P0_UP,
+	P0_DOWN,
+	P0_LEFT,
+	P0_RIGHT
+};
+
+typedef struct pia_t {
+	cycles_t pia_cycles;
+	/* Timer, see set_timer() */
+	cycles_t timer_start;
+	byte_t timer_intervals;
+	uint32_t timer_number;
+	/* Ports */
+	byte_t swcha;
+	byte_t swacnt;
+	byte_t swchb;
+} pia_t;
+
+/* Power-on state of the ports and timer */
+void pia_init(emu_t *emu);
+void pia_process_input(emu_t *emu, enum joystick_t j);
+/* Hold the joystick switches set in pressed, bit j for joystick_t j, and
+ * release the others
+ */
+void pia_set_joysticks(emu_t *emu, byte_t pressed);
+void cnt_pia_cycles(emu_t *emu, uint32_t cycles);
+/* Ports and timer, addr anywhere in the RIOT's I/O pages */
+byte_t pia_read(emu_t *emu, addr_t addr);
+void pia_write(emu_t *emu, addr_t addr, byte_t b);
 
 #endif
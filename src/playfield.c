@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include "playfield.h"
+#include "tia.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLAYFIELD_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Playfield Expansion
+ *
+ * The playfield is 40 cells, each 4 pixels wide. The 20 cells of the left
+ * half come from PF0 (bits 4-7), PF1 (bits 7-0) and PF2 (bits 0-7), in that
+ * order. The right half repeats them, or mirrors them if CTRLPF asks for
+ * reflection.
+ *
+ * The registers are first packed into one word with a bit per cell, the
+ * rest is turning every bit into 4 bytes. The vector versions do that for
+ * a byte of cells at a time: the byte is broadcast to every lane, and each
+ * group of 4 lanes tests its own bit, which gives a mask to select between
+ * the set and the clear value with.
+ */
+
+#define CELL_W 4
+#define HALF_CELLS 20
+
+static uint32_t reverse_bits(uint32_t v, int n) {
+	uint32_t r = 0;
+	for (int i = 0; i < n; ++i) {
+		r = (r << 1) | ((v >> i) & 1);
+	}
+	return r;
+}
+
+/* Bit n is set if cell n of the scanline is part of the playfield */
+static uint64_t playfield_cells(byte_t pf0, byte_t pf1, byte_t pf2, byte_t ctrlpf) {
+	uint32_t half = (pf0 >> 4) | (reverse_bits(pf1, 8) << 4) | ((uint32_t)pf2 << 12);
+	uint32_t right = (ctrlpf & 0x01) ? reverse_bits(half, HALF_CELLS) : half;
+	return half | ((uint64_t)right << HALF_CELLS);
+}
+
+void playfield_mask(uint64_t mask[3], byte_t pf0, byte_t pf1, byte_t pf2, byte_t ctrlpf) {
+	uint64_t cells = playfield_cells(pf0, pf1, pf2, ctrlpf);
+	mask[0] = mask[1] = mask[2] = 0;
+	/* A word holds 16 whole cells */
+	while (cells) {
+		int n = __builtin_ctzll(cells);
+		mask[n / 16] |= (uint64_t)0x0f << (CELL_W * (n % 16));
+		cells &= cells - 1;
+	}
+}
+
+void playfield_expand_scalar(byte_t *line, byte_t pf0, byte_t pf1, byte_t pf2,
+		byte_t ctrlpf, const byte_t set[2], byte_t clear) {
+	uint64_t cells = playfield_cells(pf0, pf1, pf2, ctrlpf);
+	for (int x = 0; x < VISIBLE_WIDTH; ++x) {
+		byte_t on = set[x >= VISIBLE_WIDTH / 2];
+		line[x] = ((cells >> (x / CELL_W)) & 1) ? on : clear;
+	}
+}
+
+#ifdef PLAYFIELD_X86
+
+/* 16 pixels, 4 cells, per vector */
+__attribute__((target("sse2")))
+static void playfield_expand_sse2(byte_t *line, byte_t pf0, byte_t pf1, byte_t pf2,
+		byte_t ctrlpf, const byte_t set[2], byte_t clear) {
+	uint64_t cells = playfield_cells(pf0, pf1, pf2, ctrlpf);
+	const __m128i select = _mm_setr_epi8(1, 1, 1, 1, 2, 2, 2, 2,
+			4, 4, 4, 4, 8, 8, 8, 8);
+	const __m128i vclear = _mm_set1_epi8(clear);
+	for (int i = 0; i < VISIBLE_WIDTH / 16; ++i) {
+		__m128i bits = _mm_set1_epi8((cells >> (4 * i)) & 0x0f);
+		__m128i mask = _mm_cmpeq_epi8(_mm_and_si128(bits, select), select);
+		__m128i von = _mm_set1_epi8(set[i >= VISIBLE_WIDTH / 32]);
+		__m128i v = _mm_or_si128(_mm_and_si128(mask, von), _mm_andnot_si128(mask, vclear));
+		_mm_storeu_si128((__m128i *)(line + 16 * i), v);
+	}
+}
+
+/* 32 pixels, 8 cells, per vector. The middle vector straddles both halves */
+__attribute__((target("avx2")))
+static void playfield_expand_avx2(byte_t *line, byte_t pf0, byte_t pf1, byte_t pf2,
+		byte_t ctrlpf, const byte_t set[2], byte_t clear) {
+	uint64_t cells = playfield_cells(pf0, pf1, pf2, ctrlpf);
+	const __m256i select = _mm256_setr_epi8(1, 1, 1, 1, 2, 2, 2, 2,
+			4, 4, 4, 4, 8, 8, 8, 8,
+			16, 16, 16, 16, 32, 32, 32, 32,
+			64, 64, 64, 64, -128, -128, -128, -128);
+	const __m256i vclear = _mm256_set1_epi8(clear);
+	const __m256i vleft = _mm256_set1_epi8(set[0]);
+	const __m256i vright = _mm256_set1_epi8(set[1]);
+	const __m256i vmiddle = _mm256_blend_epi32(vleft, vright, 0xf0);
+	for (int i = 0; i < VISIBLE_WIDTH / 32; ++i) {
+		__m256i bits = _mm256_set1_epi8((char)(cells >> (8 * i)));
+		__m256i mask = _mm256_cmpeq_epi8(_mm256_and_si256(bits, select), select);
+		__m256i von = i < 2 ? vleft : (i > 2 ? vright : vmiddle);
+		__m256i v = _mm256_blendv_epi8(vclear, von, mask);
+		_mm256_storeu_si256((__m256i *)(line + 32 * i), v);
+	}
+}
+
+#endif
+
+typedef void (*expand_fn)(byte_t *, byte_t, byte_t, byte_t, byte_t, const byte_t *, byte_t);
+static expand_fn expand = playfield_expand_scalar;
+
+_Bool playfield_use(enum playfield_kernel_t k) {
+	switch (k) {
+		case PLAYFIELD_SCALAR:
+			expand = playfield_expand_scalar;
+			log_trace("Playfield expansion: scalar");
+			return 1;
+#ifdef PLAYFIELD_X86
+		case PLAYFIELD_SSE2:
+			if (!__builtin_cpu_supports("sse2")) {
+				return 0;
+			}
+			expand = playfield_expand_sse2;
+			log_trace("Playfield expansion: SSE2");
+			return 1;
+		case PLAYFIELD_AVX2:
+			if (!__builtin_cpu_supports("avx2")) {
+				return 0;
+			}
+			expand = playfield_expand_avx2;
+			log_trace("Playfield expansion: AVX2");
+			return 1;
+#endif
+		default:
+			return 0;
+	}
+}
+
+void playfield_init() {
+#ifdef PLAYFIELD_X86
+	__builtin_cpu_init();
+#endif
+	for (int k = NPLAYFIELD_KERNELS - 1; k >= 0; --k) {
+		if (playfield_use(k)) {
+			return;
+		}
+	}
+}
+
+void playfield_expand(byte_t *line, byte_t pf0, byte_t pf1, byte_t pf2,
+		byte_t ctrlpf, const byte_t set[2], byte_t clear) {
+	expand(line, pf0, pf1, pf2, ctrlpf, set, clear);
+}
@@ -0,0 +1,39 @@
+#ifndef PLAYFIELD_H
+#define PLAYFIELD_H
+
+#include <stdint.h>
+#include "mspace.h"
+
+/* The versions of playfield_expand(), slowest first */
+enum playfield_kernel_t {
+	PLAYFIELD_SCALAR,
+	PLAYFIELD_SSE2,
+	PLAYFIELD_AVX2,
+	NPLAYFIELD_KERNELS
+};
+
+/* Pick the fastest playfield_expand() this CPU can run */
+void playfield_init();
+/* Have playfield_expand() run kernel k. Returns 0, leaving the current one
+ * in place, if this CPU or build can't run it
+ */
+_Bool playfield_use(enum playfield_kernel_t k);
+
+/* Expand the playfield registers into a scanline of VISIBLE_WIDTH bytes.
+ * A pixel covered by the playfield gets set[0] on the left half of the
+ * scanline and set[1] on the right half, any other pixel gets clear.
+ * Bit 0 of ctrlpf reflects the right half.
+ */
+void playfield_expand(byte_t *line, byte_t pf0, byte_t pf1, byte_t pf2,
+		byte_t ctrlpf, const byte_t set[2], byte_t clear);
+
+/* The pixels the playfield covers, bit x of mask[x / 64] for pixel x of
+ * the scanline, as the TIA lays out its objects
+ */
+void playfield_mask(uint64_t mask[3], byte_t pf0, byte_t pf1, byte_t pf2, byte_t ctrlpf);
+
+/* The portable version, the others must give the same results */
+void playfield_expand_scalar(byte_t *line, byte_t pf0, byte_t pf1, byte_t pf2,
+		byte_t ctrlpf, const byte_t set[2], byte_t clear);
+
+#endif
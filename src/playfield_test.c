@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "playfield.h"
+#include "tia.h"
+#include "log.h"
+
+/*
+ * Checks every version of playfield_expand() this CPU can run, first
+ * against scanlines worked out by hand, then against
+ * playfield_expand_scalar() for all PF0/PF1/PF2 patterns and every
+ * combination of the CTRLPF reflect and score bits. Only the high nibble
+ * of PF0 is drawn, so its low nibble is left at 0.
+ */
+
+#define LEFT_COLOR 0x1e
+#define RIGHT_COLOR 0x44
+#define CLEAR_COLOR 0x80
+
+static const char *kernel_names[NPLAYFIELD_KERNELS] = { "scalar", "SSE2", "AVX2" };
+
+/* The 40 cells of a scanline, '#' where the playfield is drawn */
+static const struct {
+	byte_t pf0, pf1, pf2, ctrlpf;
+	const char *cells;
+} known[] = {
+	{ 0x10, 0x00, 0x00, 0x00, "#...................#..................." },
+	{ 0xf0, 0xff, 0xff, 0x03, "########################################" },
+	{ 0x00, 0x80, 0x01, 0x01, "....#.......#..............#.......#...." },
+	{ 0x20, 0x01, 0x80, 0x02, ".#.........#.......#.#.........#.......#" },
+	{ 0x20, 0x01, 0x80, 0x03, ".#.........#.......##.......#.........#." },
+	{ 0xa0, 0x55, 0xaa, 0x00, ".#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#" },
+};
+
+/* Score mode draws each half in its player's color */
+static void colors(byte_t ctrlpf, byte_t set[2]) {
+	set[0] = LEFT_COLOR;
+	set[1] = ctrlpf & 0x02 ? RIGHT_COLOR : LEFT_COLOR;
+}
+
+static long check_known(const char *name) {
+	byte_t line[VISIBLE_WIDTH];
+	byte_t set[2];
+	long errors = 0;
+	for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); ++i) {
+		colors(known[i].ctrlpf, set);
+		playfield_expand(line, known[i].pf0, known[i].pf1, known[i].pf2,
+				known[i].ctrlpf, set, CLEAR_COLOR);
+		for (int x = 0; x < VISIBLE_WIDTH; ++x) {
+			byte_t want = known[i].cells[x / 4] == '#' ?
+				set[x >= VISIBLE_WIDTH / 2] : CLEAR_COLOR;
+			if (line[x] != want) {
+				printf("%s: PF0 %02x PF1 %02x PF2 %02x CTRLPF %02x pixel %d is %02x, not %02x\n",
+						name, known[i].pf0, known[i].pf1, known[i].pf2,
+						known[i].ctrlpf, x, line[x], want);
+				errors++;
+				break;
+			}
+		}
+	}
+	return errors;
+}
+
+static long check_scalar(const char *name) {
+	byte_t want[VISIBLE_WIDTH];
+	byte_t got[VISIBLE_WIDTH];
+	byte_t set[2];
+	long errors = 0;
+	for (uint32_t bits = 0; bits < 1u << 20; ++bits) {
+		byte_t pf0 = (bits & 0x0f) << 4;
+		byte_t pf1 = bits >> 4;
+		byte_t pf2 = bits >> 12;
+		for (byte_t ctrlpf = 0; ctrlpf < 4; ++ctrlpf) {
+			colors(ctrlpf, set);
+			playfield_expand_scalar(want, pf0, pf1, pf2, ctrlpf, set, CLEAR_COLOR);
+			playfield_expand(got, pf0, pf1, pf2, ctrlpf, set, CLEAR_COLOR);
+			if (memcmp(want, got, VISIBLE_WIDTH) && errors++ == 0) {
+				printf("%s: PF0 %02x PF1 %02x PF2 %02x CTRLPF %02x differs from scalar\n",
+						name, pf0, pf1, pf2, ctrlpf);
+			}
+		}
+	}
+	return errors;
+}
+
+int main() {
+	int failed = 0;
+	log_set_quiet(1);
+	playfield_init();
+	for (int k = 0; k < NPLAYFIELD_KERNELS; ++k) {
+		if (!playfield_use(k)) {
+			printf("%s: not supported, skipped\n", kernel_names[k]);
+			continue;
+		}
+		long errors = check_known(kernel_names[k]) + check_scalar(kernel_names[k]);
+		printf("%s: %ld mismatches\n", kernel_names[k], errors);
+		failed |= errors != 0;
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "romdb.h"
+#include "hash.h"
+#include "log.h"
+
+/*
+ * ROM Index
+ *
+ * Telling the bank switching scheme of a cartridge from its contents means
+ * scanning all of it, so what was found is kept in a text file, a line per
+ * ROM image, keyed by the hash of the image:
+ *
+ * 5a1f0e7c9d2b3a41 F8SC NTSC joystick
+ *
+ * Lines can be edited by hand, to fix what detection got wrong. Blank lines
+ * and lines starting with '#' are skipped.
+ */
+
+#define MAX_PATH 4096
+
+static char db_path[MAX_PATH];
+
+static const char *tv_names[NTV_STANDARDS] = { "NTSC", "PAL", "SECAM" };
+static const char *controller_names[NCONTROLLERS] = { "joystick", "paddles", "keypad" };
+
+/* Index of name in names, -1 if it is not there */
+static int find_name(const char *name, const char **names, int n) {
+	for (int i = 0; i < n; ++i) {
+		if (strcmp(name, names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void romdb_open(const char *path) {
+	if (strlen(path) >= MAX_PATH) {
+		log_warn("ROM index path too long, not using it: %s", path);
+		return;
+	}
+	strcpy(db_path, path);
+}
+
+/* Parse a line of the index, return 0 if it is not a valid entry */
+static _Bool parse_entry(const char *line, uint64_t *hash, rom_info_t *info) {
+	char mapper[16], tv[16], controller[16];
+	if (sscanf(line, "%" SCNx64 " %15s %15s %15s", hash, mapper, tv, controller) != 4) {
+		return 0;
+	}
+	int t = find_name(tv, tv_names, NTV_STANDARDS);
+	int c = find_name(controller, controller_names, NCONTROLLERS);
+	if (!cart_parse_type(mapper, &info->cart) || t < 0 || c < 0) {
+		return 0;
+	}
+	info->tv = t;
+	info->controller = c;
+	return 1;
+}
+
+static _Bool lookup(uint64_t hash, rom_info_t *info) {
+	FILE *fp = fopen(db_path, "r");
+	if (!fp) {
+		return 0;
+	}
+	char line[256];
+	int lineno = 0;
+	_Bool found = 0;
+	while (!found && fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+		uint64_t h;
+		rom_info_t i;
+		if (!parse_entry(line, &h, &i)) {
+			log_warn("%s:%d: Bad entry, skipped", db_path, lineno);
+			continue;
+		}
+		if (h == hash) {
+			*info = i;
+			found = 1;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+
+static void append(uint64_t hash, const rom_info_t *info) {
+	FILE *fp = fopen(db_path, "a");
+	if (!fp) {
+		log_warn("Could not add to the ROM index %s", db_path);
+		return;
+	}
+	fprintf(fp, "%016" PRIx64 " %s%s %s %s\n", hash, cart_mapper_name(info->cart.mapper),
+			info->cart.superchip ? "SC" : "", tv_names[info->tv],
+			controller_names[info->controller]);
+	fclose(fp);
+}
+
+rom_info_t romdb_identify(const byte_t *rom, size_t size) {
+	rom_info_t info;
+	uint64_t hash = hash64(rom, size, 0);
+	_Bool found = db_path[0] && lookup(hash, &info);
+	if (found && cart_fits(info.cart, size)) {
+		log_trace("ROM %016" PRIx64 " found in the index", hash);
+		return info;
+	}
+	/* An entry edited by hand can name a scheme with more banks than
+	 * the image has, which is not trusted */
+	if (found) {
+		log_warn("%s: ROM %016" PRIx64 " is too small for %s, detecting it instead",
+				db_path, hash, cart_mapper_name(info.cart.mapper));
+	}
+	/* Nothing tells the TV standard or the controller apart yet */
+	info.cart = cart_detect(rom, size);
+	info.tv = TV_NTSC;
+	info.controller = CONTROLLER_JOYSTICK;
+	if (db_path[0] && !found) {
+		append(hash, &info);
+	}
+	return info;
+}
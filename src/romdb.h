@@ -0,0 +1,38 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include <stddef.h>
+#include "cart.h"
+
+enum tv_standard {
+	TV_NTSC,
+	TV_PAL,
+	TV_SECAM,
+	NTV_STANDARDS
+};
+
+enum controller {
+	CONTROLLER_JOYSTICK,
+	CONTROLLER_PADDLES,
+	CONTROLLER_KEYPAD,
+	NCONTROLLERS
+};
+
+/* What is known about a ROM image */
+typedef struct rom_info_t {
+	cart_type_t cart;
+	enum tv_standard tv;
+	enum controller controller;
+} rom_info_t;
+
+/* Use the index at path, created on the first write if it does not exist.
+ * Without an index every ROM is detected from its contents
+ */
+void romdb_open(const char *path);
+
+/* Look the image up in the index, or work it out from the contents and
+ * add it to the index
+ */
+rom_info_t romdb_identify(const byte_t *rom, size_t size);
+
+#endif
@@ -0,0 +1,134 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include "sdl.h"
+#include "tia.h"
+#include "pia.h"
+#include "log.h"
+#include "hash.h"
+
+/*
+ * SDL Video Backend
+ *
+ * Finished frames are converted to RGBA8888 and shown in a window, scaled
+ * up. The conversion writes straight into the locked streaming texture, and
+ * is skipped altogether if the frame hashes the same as the last one.
+ *
+ * Every frame, the keyboard events are turned into joystick input for the
+ * PIA: WASD for the left joystick, the arrow keys for the right one.
+ *
+ * There is only the one window, it is meant for a single console.
+ */
+
+static SDL_Window *gbl_window;
+static SDL_Renderer *gbl_renderer;
+static SDL_Texture *gbl_texture;
+
+static void sdl_init() {
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+	int rv = 0;
+	rv = SDL_CreateWindowAndRenderer(VISIBLE_WIDTH, VISIBLE_HEIGHT,
+			SDL_WINDOW_RESIZABLE, &gbl_window, &gbl_renderer);
+	if (rv != 0) {
+		log_fatal("SDL_CreateWindowAndRenderer(): %s", SDL_GetError());
+		goto exit;
+	}
+	SDL_SetRenderDrawColor(gbl_renderer, 0x00, 0x00, 0x00, 0xff);
+	SDL_RenderClear(gbl_renderer);
+	gbl_texture = SDL_CreateTexture(gbl_renderer, SDL_PIXELFORMAT_RGBA8888, 
+			SDL_TEXTUREACCESS_STREAMING, VISIBLE_WIDTH, VISIBLE_HEIGHT);
+	if (!gbl_texture) {
+		log_fatal("SDL_CreateTexture(): %s", SDL_GetError());
+		goto exit;
+	}
+	int scale = 8;
+	SDL_SetWindowSize(gbl_window, VISIBLE_WIDTH * scale, VISIBLE_HEIGHT * scale);
+	return;
+
+exit:
+	exit(EXIT_FAILURE);
+}
+
+static void sdl_free() {
+	SDL_Quit();
+}
+
+/* Hash of the frame in the texture, to know when it need not be uploaded */
+static uint64_t texture_hash = 0;
+static _Bool texture_valid = 0;
+
+static void sdl_present(emu_t *emu) {
+	const byte_t *frame = tia_frame(emu);
+	uint64_t h = hash64(frame, VISIBLE_WIDTH * VISIBLE_HEIGHT, 0);
+	if (!texture_valid || h != texture_hash) {
+		/* Convert straight into the texture's memory */
+		void *pixels;
+		int pitch;
+		if (SDL_LockTexture(gbl_texture, NULL, &pixels, &pitch) != 0) {
+			log_error("SDL_LockTexture(): %s", SDL_GetError());
+			return;
+		}
+		tia_convert_frame(emu, pixels, pitch, PIXEL_RGBA8888);
+		SDL_UnlockTexture(gbl_texture);
+		texture_hash = h;
+		texture_valid = 1;
+	}
+	SDL_RenderClear(gbl_renderer);
+	SDL_RenderCopy(gbl_renderer, gbl_texture, NULL, NULL);
+	SDL_RenderPresent(gbl_renderer);
+}
+
+static SDL_Event gbl_event;
+
+static void process_input(emu_t *emu, int code) {
+	switch (code) {
+		case SDL_SCANCODE_Q:
+		case SDL_SCANCODE_ESCAPE:
+			exit(EXIT_SUCCESS);
+			break;
+		case SDL_SCANCODE_W:
+			pia_process_input(emu, P0_UP);
+			break;
+		case SDL_SCANCODE_A:
+			pia_process_input(emu, P0_LEFT);
+			break;
+		case SDL_SCANCODE_S:
+			pia_process_input(emu, P0_DOWN);
+			break;
+		case SDL_SCANCODE_D:
+			pia_process_input(emu, P0_RIGHT);
+			break;
+		case SDL_SCANCODE_UP:
+			pia_process_input(emu, P1_UP);
+			break;
+		case SDL_SCANCODE_LEFT:
+			pia_process_input(emu, P1_LEFT);
+			break;
+		case SDL_SCANCODE_DOWN:
+			pia_process_input(emu, P1_DOWN);
+			break;
+		case SDL_SCANCODE_RIGHT:
+			pia_process_input(emu, P1_RIGHT);
+			break;
+		default:
+			break;
+	}
+}
+
+static void sdl_poll(emu_t *emu) {
+	while (SDL_PollEvent(&gbl_event) != 0) {
+			if (gbl_event.type == SDL_QUIT) {
+				exit(EXIT_SUCCESS);
+			}
+			else {
+				process_input(emu, gbl_event.key.keysym.scancode);
+			}
+	}
+}
+
+const video_backend_t sdl_backend = {
+	"sdl",
+	sdl_init,
+	sdl_free,
+	sdl_present,
+	sdl_poll
+};
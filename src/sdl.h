@@ -0,0 +1,9 @@
+#ifndef SDL_H
+#define SDL_H
+
+#include "tia.h"
+
+/* Presents frames in a window, and takes joystick input from the keyboard */
+extern const video_backend_t sdl_backend;
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <string.h>
+#include "sprite.h"
+#include "tia.h"
+#include "log.h"
+
+/*
+ * Sprite Tables
+ *
+ * NUSIZx selects how many copies of a player (and its missile) are drawn,
+ * how far apart, and how wide every pixel of a player is. Rather than
+ * working that out a pixel at a time, every combination of graphics byte,
+ * NUSIZx mode and reflection is laid out once, at startup, as a scanline
+ * mask with the first copy at pixel 0. Drawing an object is then a matter
+ * of rotating its mask to the object's position.
+ */
+
+#define NMODES 8
+#define MAX_COPIES 3
+
+/* Pixel offsets of the copies, for each of the NUSIZx modes */
+static const unsigned int copy_offsets[NMODES][MAX_COPIES] = {
+	{ 0 },
+	{ 0, 16 },
+	{ 0, 32 },
+	{ 0, 16, 32 },
+	{ 0, 64 },
+	{ 0 },
+	{ 0, 32, 64 },
+	{ 0 }
+};
+static const unsigned int ncopies[NMODES] = { 1, 2, 2, 3, 2, 1, 3, 1 };
+/* Width of a player pixel */
+static const unsigned int player_scale[NMODES] = { 1, 1, 1, 1, 1, 2, 1, 4 };
+
+static sprite_mask_t player_tbl[NMODES][2][256];
+/* Missile width is 1, 2, 4 or 8, from bits 4-5 of NUSIZx */
+static sprite_mask_t missile_tbl[NMODES][4];
+/* Likewise the ball, from bits 4-5 of CTRLPF */
+static sprite_mask_t ball_tbl[4];
+
+static void set_pixel(sprite_mask_t *m, unsigned int x) {
+	x %= VISIBLE_WIDTH;
+	m->w[x >> 6] |= (uint64_t)1 << (x & 63);
+}
+
+void sprite_init() {
+	memset(player_tbl, 0, sizeof(player_tbl));
+	memset(missile_tbl, 0, sizeof(missile_tbl));
+	memset(ball_tbl, 0, sizeof(ball_tbl));
+	for (int size = 0; size < 4; ++size) {
+		for (unsigned int k = 0; k < (1u << size); ++k) {
+			set_pixel(&ball_tbl[size], k);
+		}
+	}
+	for (int mode = 0; mode < NMODES; ++mode) {
+		unsigned int scale = player_scale[mode];
+		/* Stretched players start a pixel late */
+		unsigned int delay = scale > 1 ? 1 : 0;
+		for (int reflect = 0; reflect < 2; ++reflect) {
+			for (int grp = 0; grp < 256; ++grp) {
+				sprite_mask_t *m = &player_tbl[mode][reflect][grp];
+				for (unsigned int c = 0; c < ncopies[mode]; ++c) {
+					for (int i = 0; i < 8; ++i) {
+						/* Bit 7 is drawn first, unless reflected */
+						int bit = reflect ? i : 7 - i;
+						if (!((grp >> bit) & 1)) {
+							continue;
+						}
+						unsigned int x = copy_offsets[mode][c] + delay + i * scale;
+						for (unsigned int k = 0; k < scale; ++k) {
+							set_pixel(m, x + k);
+						}
+					}
+				}
+			}
+		}
+		for (int size = 0; size < 4; ++size) {
+			sprite_mask_t *m = &missile_tbl[mode][size];
+			for (unsigned int c = 0; c < ncopies[mode]; ++c) {
+				for (unsigned int k = 0; k < (1u << size); ++k) {
+					set_pixel(m, copy_offsets[mode][c] + k);
+				}
+			}
+		}
+	}
+	log_trace("Initialized Sprite Tables");
+}
+
+static void shift_left(sprite_mask_t *d, const sprite_mask_t *s, unsigned int n) {
+	unsigned int words = n / 64, bits = n % 64;
+	for (int i = 2; i >= 0; --i) {
+		int j = i - (int)words;
+		uint64_t v = 0;
+		if (j >= 0) {
+			v = s->w[j] << bits;
+			if (bits && j > 0) {
+				v |= s->w[j - 1] >> (64 - bits);
+			}
+		}
+		d->w[i] = v;
+	}
+}
+
+static void shift_right(sprite_mask_t *d, const sprite_mask_t *s, unsigned int n) {
+	unsigned int words = n / 64, bits = n % 64;
+	for (int i = 0; i < 3; ++i) {
+		int j = i + (int)words;
+		uint64_t v = 0;
+		if (j < 3) {
+			v = s->w[j] >> bits;
+			if (bits && j < 2) {
+				v |= s->w[j + 1] << (64 - bits);
+			}
+		}
+		d->w[i] = v;
+	}
+}
+
+/* Move every pixel n to the right, wrapping around the end of the scanline */
+static void rotate(sprite_mask_t *d, const sprite_mask_t *s, unsigned int n) {
+	sprite_mask_t wrapped;
+	shift_left(d, s, n);
+	shift_right(&wrapped, s, VISIBLE_WIDTH - n);
+	for (int i = 0; i < 3; ++i) {
+		d->w[i] |= wrapped.w[i];
+	}
+	/* Drop whatever was pushed past the end */
+	d->w[2] &= ((uint64_t)1 << (VISIBLE_WIDTH - 128)) - 1;
+}
+
+void sprite_player(sprite_mask_t *m, byte_t grp, byte_t nusiz, _Bool reflect, unsigned int pos) {
+	rotate(m, &player_tbl[nusiz & 0x07][reflect][grp], pos % VISIBLE_WIDTH);
+}
+
+void sprite_missile(sprite_mask_t *m, byte_t nusiz, unsigned int pos) {
+	rotate(m, &missile_tbl[nusiz & 0x07][(nusiz >> 4) & 0x03], pos % VISIBLE_WIDTH);
+}
+
+void sprite_ball(sprite_mask_t *m, byte_t ctrlpf, unsigned int pos) {
+	rotate(m, &ball_tbl[(ctrlpf >> 4) & 0x03], pos % VISIBLE_WIDTH);
+}
@@ -0,0 +1,30 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stdint.h>
+#include "mspace.h"
+
+/* A bit for every pixel of the visible scanline, bit x of the mask is
+ * pixel x of the scanline
+ */
+typedef struct sprite_mask_t {
+	uint64_t w[3];
+} sprite_mask_t;
+
+#define sprite_test(m, x) (((m)->w[(x) >> 6] >> ((x) & 63)) & 1)
+
+/* Build the player and missile tables */
+void sprite_init();
+
+/* Pixels covered by a player drawing grp, laid out by the lower 3 bits of
+ * nusiz, and mirrored if reflect is set, with its first copy at pos
+ */
+void sprite_player(sprite_mask_t *m, byte_t grp, byte_t nusiz, _Bool reflect, unsigned int pos);
+
+/* Pixels covered by a missile, copies and width as given by nusiz */
+void sprite_missile(sprite_mask_t *m, byte_t nusiz, unsigned int pos);
+
+/* Pixels covered by the ball, width as given by ctrlpf */
+void sprite_ball(sprite_mask_t *m, byte_t ctrlpf, unsigned int pos);
+
+#endif
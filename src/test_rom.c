@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_rom.h"
+#include "log.h"
+
+/*
+ * The Test ROM
+ *
+ * A 4K kernel that draws a frame from the controls: the joysticks move the
+ * players and pick their graphics, the fire buttons bump a BCD score and
+ * stir a byte that drives the other player, the missile and the ball.
+ * Collisions are read back into the game state, so consoles given
+ * different inputs soon run different code. JOY, FRAME, SCORE, MIX, HITS,
+ * PTR and ACC are RAM from 0x80 up.
+ *
+ * start:	SEI
+ * 	CLD
+ * 	LDX #0
+ * 	TXA
+ * clear:	DEX
+ * 	TXS
+ * 	PHA
+ * 	BNE clear
+ * 	LDA #$1E
+ * 	STA COLUP0
+ * 	LDA #$44
+ * 	STA COLUP1
+ * 	LDA #$C6
+ * 	STA COLUPF
+ * 	LDA #$31
+ * 	STA CTRLPF
+ * 	LDA #$05
+ * 	STA NUSIZ0
+ * 	LDA #$10
+ * 	STA NUSIZ1
+ * 	LDA #<table
+ * 	STA PTR
+ * 	LDA #>table
+ * 	STA PTR+1
+ * 	STA WSYNC
+ * 	LDX #6
+ * pos:	DEX
+ * 	BNE pos
+ * 	STA RESP0
+ * 	STA RESM0
+ * 	NOP
+ * 	STA RESP1
+ * 	STA RESBL
+ * frame:	LDA #2
+ * 	STA VSYNC
+ * 	STA WSYNC
+ * 	STA WSYNC
+ * 	STA WSYNC
+ * 	LDA #0
+ * 	STA VSYNC
+ * 	LDA #43
+ * 	STA TIM64T
+ * 	JSR logic
+ * 	STA WSYNC
+ * 	STA HMOVE
+ * 	LDA CXPPMM
+ * 	ORA CXP0FB
+ * 	ORA CXM0P
+ * 	STA HITS
+ * 	STA CXCLR
+ * wait:	LDA INTIM
+ * 	BNE wait
+ * 	STA WSYNC
+ * 	STA VBLANK
+ * 	LDY #192
+ * line:	STA WSYNC
+ * 	TYA
+ * 	CLC
+ * 	ADC FRAME
+ * 	STA COLUBK
+ * 	EOR SCORE
+ * 	STA PF1
+ * 	LDA (PTR),Y
+ * 	EOR JOY
+ * 	STA GRP0
+ * 	AND #$02
+ * 	STA ENABL
+ * 	LDA MIX
+ * 	STA GRP1
+ * 	STA ENAM0
+ * 	DEY
+ * 	BNE line
+ * 	LDA #2
+ * 	STA VBLANK
+ * 	LDX #30
+ * over:	STA WSYNC
+ * 	DEX
+ * 	BNE over
+ * 	JMP frame
+ *
+ * Game state from the controls, with a bit of everything
+ * logic:	LDA SWCHA
+ * 	STA JOY
+ * 	AND #$F0
+ * 	STA HMP0
+ * 	LDA JOY
+ * 	ASL A
+ * 	ASL A
+ * 	ASL A
+ * 	ASL A
+ * 	STA HMP1
+ * 	INC FRAME
+ * 	BIT INPT4
+ * 	BMI nofire0
+ * 	SED
+ * 	LDA SCORE
+ * 	CLC
+ * 	ADC #$07
+ * 	STA SCORE
+ * 	LDA ACC
+ * 	SEC
+ * 	SBC #$13
+ * 	STA ACC
+ * 	CLD
+ * nofire0:	LDA INPT5
+ * 	BMI nofire1
+ * 	LDA MIX
+ * 	ROL A
+ * 	EOR #$5A
+ * 	STA MIX
+ * 	LDX #4
+ * spin:	LDA table,X
+ * 	ADC MIX
+ * 	ROR A
+ * 	STA MIX
+ * 	DEX
+ * 	BPL spin
+ * nofire1:	LDA JOY
+ * 	CMP #$FF
+ * 	BEQ idle
+ * 	PHA
+ * 	LDA HITS
+ * 	AND #$C0
+ * 	PLA
+ * 	BEQ idle
+ * 	EOR FRAME
+ * 	STA PF2
+ * 	TAX
+ * 	LDA table,X
+ * 	STA PF0
+ * idle:	LDA FRAME
+ * 	AND #$3F
+ * 	BNE done
+ * 	LDA SCORE
+ * 	EOR MIX
+ * 	STA COLUP1
+ * done:	RTS
+ *
+ * table is the 16 bytes at the end of rom[].
+ */
+
+static const byte_t rom[] = {
+	0x78, 0xd8, 0xa2, 0x00, 0x8a, 0xca, 0x9a, 0x48, 0xd0, 0xfb, 0xa9, 0x1e,
+	0x85, 0x06, 0xa9, 0x44, 0x85, 0x07, 0xa9, 0xc6, 0x85, 0x08, 0xa9, 0x31,
+	0x85, 0x0a, 0xa9, 0x05, 0x85, 0x04, 0xa9, 0x10, 0x85, 0x05, 0xa9, 0xfa,
+	0x85, 0x85, 0xa9, 0xf0, 0x85, 0x86, 0x85, 0x02, 0xa2, 0x06, 0xca, 0xd0,
+	0xfd, 0x85, 0x10, 0x85, 0x12, 0xea, 0x85, 0x11, 0x85, 0x14, 0xa9, 0x02,
+	0x85, 0x00, 0x85, 0x02, 0x85, 0x02, 0x85, 0x02, 0xa9, 0x00, 0x85, 0x00,
+	0xa9, 0x2b, 0x8d, 0x96, 0x02, 0x20, 0x96, 0xf0, 0x85, 0x02, 0x85, 0x2a,
+	0xa5, 0x07, 0x05, 0x02, 0x05, 0x00, 0x85, 0x84, 0x85, 0x2c, 0xad, 0x84,
+	0x02, 0xd0, 0xfb, 0x85, 0x02, 0x85, 0x01, 0xa0, 0xc0, 0x85, 0x02, 0x98,
+	0x18, 0x65, 0x81, 0x85, 0x09, 0x45, 0x82, 0x85, 0x0e, 0xb1, 0x85, 0x45,
+	0x80, 0x85, 0x1b, 0x29, 0x02, 0x85, 0x1f, 0xa5, 0x83, 0x85, 0x1c, 0x85,
+	0x1d, 0x88, 0xd0, 0xe1, 0xa9, 0x02, 0x85, 0x01, 0xa2, 0x1e, 0x85, 0x02,
+	0xca, 0xd0, 0xfb, 0x4c, 0x3a, 0xf0, 0xad, 0x80, 0x02, 0x85, 0x80, 0x29,
+	0xf0, 0x85, 0x20, 0xa5, 0x80, 0x0a, 0x0a, 0x0a, 0x0a, 0x85, 0x21, 0xe6,
+	0x81, 0x24, 0x0c, 0x30, 0x10, 0xf8, 0xa5, 0x82, 0x18, 0x69, 0x07, 0x85,
+	0x82, 0xa5, 0x87, 0x38, 0xe9, 0x13, 0x85, 0x87, 0xd8, 0xa5, 0x0d, 0x30,
+	0x14, 0xa5, 0x83, 0x2a, 0x49, 0x5a, 0x85, 0x83, 0xa2, 0x04, 0xbd, 0xfa,
+	0xf0, 0x65, 0x83, 0x6a, 0x85, 0x83, 0xca, 0x10, 0xf5, 0xa5, 0x80, 0xc9,
+	0xff, 0xf0, 0x12, 0x48, 0xa5, 0x84, 0x29, 0xc0, 0x68, 0xf0, 0x0a, 0x45,
+	0x81, 0x85, 0x0f, 0xaa, 0xbd, 0xfa, 0xf0, 0x85, 0x0d, 0xa5, 0x81, 0x29,
+	0x3f, 0xd0, 0x06, 0xa5, 0x82, 0x45, 0x83, 0x85, 0x07, 0x60, 0x00, 0x18,
+	0x3c, 0x7e, 0xff, 0x7e, 0x3c, 0x18, 0x81, 0x42, 0x24, 0x18, 0x18, 0x24,
+	0x42, 0x81,
+};
+
+static char path[] = "/tmp/a26_test_romXXXXXX";
+
+static void remove_rom() {
+	unlink(path);
+}
+
+char *test_rom_file() {
+	static _Bool written = 0;
+	if (written) {
+		return path;
+	}
+	byte_t image[0x1000] = { 0 };
+	memcpy(image, rom, sizeof(rom));
+	/* Reset and break vectors, to 0xf000 */
+	image[0x0ffd] = image[0x0fff] = 0xf0;
+	int fd = mkstemp(path);
+	if (fd < 0 || write(fd, image, sizeof(image)) != sizeof(image)) {
+		log_fatal("test_rom_file(): Could not write %s", path);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	atexit(remove_rom);
+	written = 1;
+	return path;
+}
@@ -0,0 +1,11 @@
+#ifndef TEST_ROM_H
+#define TEST_ROM_H
+
+#include "mspace.h"
+
+/* The tests' ROM, written out to a temporary file the first time round and
+ * removed at exit. Returns its path
+ */
+char *test_rom_file();
+
+#endif
@@ -1,106 +1,54 @@
-#include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "tia.h"
 #include "mspace.h"
 #include "log.h"
 #include "pia.h"
+#include "cpu.h"
+#include "playfield.h"
+#include "sprite.h"
+#include "palette.h"
+#include "emu.h"
 
 /*
  * General Structure of the TIA
  *
  * In the VCS, TIA and the CPU ran parallely. As a multi-threaded
  * program would lead to needless complexity, the CPU and the TIA,
- * in this program take 'turns' executing. The CPU executes one 
- * instruction and passes the number of cycles it took executing
- * that instruction to the TIA. As the TIA ran 3x faster than the
- * CPU in the VCS, it gets to do 3x the work that the CPU did during
- * its turn. For example, if an instruction took 4 cycles, the TIA
- * gets to execute 12 (4x3) cycles.
+ * in this program take 'turns' executing. The CPU runs freely and
+ * the TIA is only brought up to date ('synced') when it has to be:
+ * when the CPU reads or writes one of its registers, and when the
+ * caller asks for it at the end of a run. As the TIA ran 3x faster
+ * than the CPU in the VCS, syncing runs it up to 3x the machine cycle
+ * count. For example, if the CPU ran 4 cycles since the last sync, the
+ * TIA gets to execute 12 (4x3) color clocks. Nothing the TIA draws
+ * can change between two register writes, so a sync can work a whole
+ * scanline at a time.
+ *
+ * Writing to WSYNC halts the CPU until the end of the scanline. This is
+ * done by adding the remaining cycles of the scanline to the machine
+ * cycle count.
+ *
+ * A frame is over when the game turns on vertical sync, or, for a game that
+ * never does, after MAX_HEIGHT scanlines. Turning on vertical sync makes
+ * the CPU return to its caller, tia_frame_done() tells the caller about the
+ * finished frame, which is presented by display().
  *
  * How Inputs from the keyboard are handled
  *
- * run_pia() calls handle_input() in main() after run_cpu() and run_tia() are 
- * called. All inputs meant for the PIA are handled by pia_process_input(). 
+ * emu_run_frame() calls handle_input() once a frame is complete, which has
+ * the video backend poll for input. Joystick input is handed to the PIA
+ * through pia_process_input().
  *
  */
 
-#define NSTROBE 14
-static int strobe_registers[NSTROBE] = {
-	WSYNC,
-	RSYNC,
-	RESP0,
-	RESP1,
-	RESM0,
-	RESM1,
-	RESBL,
-	HMOVE,
-	HMCLR,
-	CXCLR,
-	TIM1T,
-	TIM8T,
-	TIM64T,
-	T1024T
-};
-
-static cycles_t COLOR_CLOCKS = 0;
-
-void cnt_color_clocks(cycles_t inc) {
-	COLOR_CLOCKS += inc;
-}
-
-cycles_t fetch_color_clocks() {
-	return COLOR_CLOCKS;
-}
-
-int is_strobe(addr_t reg) {
-	for (int i = 0; i < NSTROBE; ++i) {
-		if (reg == strobe_registers[i]) {
-			return 1;
-		}
-	}
-	return 0;
+void cnt_color_clocks(emu_t *emu, cycles_t inc) {
+	emu->machine.tia.color_clocks += inc;
 }
 
-void strobe_dispatch(addr_t reg, byte_t b) {
-	switch (reg) {
-		case WSYNC:
-			break;
-		case RSYNC:
-			break;
-		case RESP0:
-			break;
-		case RESP1:
-			break;
-		case RESM0:
-			break;
-		case RESM1:
-			break;
-		case RESBL:
-			break;
-		case HMOVE:
-			break;
-		case HMCLR:
-			break;
-		case CXCLR:
-			break;
-		case TIM1T:
-			set_timer(b, 1);
-			break;
-		case TIM8T:
-			set_timer(b, 8);
-			break;
-		case TIM64T:
-			set_timer(b, 64);
-			break;
-		case T1024T:
-			set_timer(b, 1024);
-			break;
-		default:
-			/* Following line will never be reached by any code */
-			log_debug("Not a strobe register: %04x", reg);
-			break;
-	}
+cycles_t fetch_color_clocks(emu_t *emu) {
+	return emu->machine.tia.color_clocks;
 }
 
 static pixel_t color_map[256];
@@ -254,175 +202,537 @@ void init_color_map() {
 }
 
 
-int is_vsync_on() {
-	byte_t a = fetch_byte(VSYNC);
+int is_vsync_on(const tia_t *tia) {
+	byte_t a = tia->regs[VSYNC];
 	return ((a & 0x02) >> 1);
 }
 
-int is_vblank_on() {
-	byte_t a = fetch_byte(VBLANK);
+int is_vblank_on(const tia_t *tia) {
+	byte_t a = tia->regs[VBLANK];
 	return ((a & 0x02) >> 1);
 }
 
-static pixel_t frame_buffer[VISIBLE_HEIGHT * VISIBLE_WIDTH];
+/* Color registers hold the hue and luminance, the color index, in bits 1-7 */
+#define color_of(reg) (tia->regs[reg] & 0xfe)
 
-pixel_t select_pixel() {
-	return color_map[0x0e];
-}
 
+#define FIRST_VISIBLE_LINE (VSYNC_H + VBLANK_H)
+#define cal_total_cindex(h, v) (((v) * VISIBLE_WIDTH) + (h))
 
-/* Pointers
- * hi - horizontal index
- * vi - vertical index
- * chi - horizontal index in the visible region
- * cvi - vertical index in the visible region
+
+/*
+ * Objects
  *
- * ti - total index
- * cti - total index in the visible region
+ * The movable objects are kept as their horizontal position, in pixels
+ * from the left edge of the visible scanline. Positions are set by the
+ * RESxx strobes and nudged by HMOVE.
  */
 
-static unsigned int hi = 0;
-static unsigned int vi = 0;
-static unsigned int chi = 0;
-static unsigned int cvi = 0;
+/* HMOVE during horizontal blank blacks out the first 8 pixels of the line */
+#define HMOVE_BLANK_W 8
 
-static unsigned int ti = 0;
-static unsigned int cti = 0;
-
-#define cal_total_index(h, v) ((v * TOTAL_WIDTH) + h)
-#define cal_total_cindex(h, v) ((v * VISIBLE_WIDTH) + h)
+/* Objects reset during horizontal blank appear at the left edge, otherwise
+ * they show up a few pixels after the beam position of the strobe */
+static unsigned int reset_position(const tia_t *tia, unsigned int delay) {
+	if (tia->hi < HBLANK_W) {
+		return delay - 2;
+	}
+	return (tia->hi - HBLANK_W + delay) % VISIBLE_WIDTH;
+}
 
-/* If we are on the screen right now */
-int isonscreen() {
-	if (( (hi > HBLANK_W) && (vi > VBLANK_H + VSYNC_H) ) &&
-		( (hi < TOTAL_WIDTH) && (vi < VBLANK_H + VSYNC_H + VISIBLE_HEIGHT) ) && 
-		( (!is_vsync_on()) && (!is_vblank_on()) )) {
-		return 1;
+static void hmove(tia_t *tia) {
+	for (int i = 0; i < NOBJECTS; ++i) {
+		/* The upper nibble is the signed motion, positive is to the left */
+		int motion = (int8_t)tia->regs[HMP0 + i] >> 4;
+		tia->pos[i] = (tia->pos[i] + VISIBLE_WIDTH - motion) % VISIBLE_WIDTH;
+	}
+	if (tia->hi < HBLANK_W) {
+		tia->hmove_blank = 1;
 	}
-	return 0;
 }
 
-/* responsible for handling cti */
-void place_pixel() {
-	pixel_t p = select_pixel();
-	frame_buffer[cti] = p;
+/* Object bits of the mask of a pixel */
+enum object_mask {
+	MASK_PF = 0x01,
+	MASK_BL = 0x02,
+	MASK_P0 = 0x04,
+	MASK_P1 = 0x08,
+	MASK_M0 = 0x10,
+	MASK_M1 = 0x20
+};
 
-	chi++;
-	if (chi > VISIBLE_WIDTH) {
-		chi = 0;
-		cvi++;
+static void update_objects(const tia_t *tia, tia_cache_t *cache) {
+	static const sprite_mask_t none;
+	for (int n = 0; n < 2; ++n) {
+		byte_t grp = (tia->regs[VDELP0 + n] & 0x01) ? tia->grp_old[n] : tia->regs[GRP0 + n];
+		sprite_player(&cache->obj_mask[OBJ_P0 + n], grp, tia->regs[NUSIZ0 + n],
+				(tia->regs[REFP0 + n] >> 3) & 0x01, tia->pos[OBJ_P0 + n]);
+		/* A missile locked to its player is not drawn */
+		cache->obj_mask[OBJ_M0 + n] = none;
+		if ((tia->regs[ENAM0 + n] & 0x02) && !(tia->regs[RESMP0 + n] & 0x02)) {
+			sprite_missile(&cache->obj_mask[OBJ_M0 + n], tia->regs[NUSIZ0 + n], tia->pos[OBJ_M0 + n]);
+		}
 	}
-
-	if (cvi > VISIBLE_HEIGHT) {
-		cvi = 0;
+	byte_t enabl = (tia->regs[VDELBL] & 0x01) ? tia->enabl_old : tia->regs[ENABL];
+	cache->obj_mask[OBJ_BL] = none;
+	if (enabl & 0x02) {
+		sprite_ball(&cache->obj_mask[OBJ_BL], tia->regs[CTRLPF], tia->pos[OBJ_BL]);
 	}
-	cti = cal_total_cindex(chi, cvi);
+	cache->obj_dirty = 0;
+}
+
+/* A missile released from its player is put at the player's center */
+static void unlock_missile(tia_t *tia, int n) {
+	static const unsigned int center[8] = { 3, 3, 3, 3, 3, 6, 3, 10 };
+	tia->pos[OBJ_M0 + n] = (tia->pos[OBJ_P0 + n] + center[tia->regs[NUSIZ0 + n] & 0x07]) % VISIBLE_WIDTH;
+}
+
+
+/*
+ * Playfield
+ *
+ * The playfield is kept as a mask of the pixels it covers, a bit per pixel
+ * like the objects. It is rebuilt by playfield_mask() before drawing, if
+ * any of the registers it depends on have been written since.
+ */
+
+static void update_playfield(const tia_t *tia, tia_cache_t *cache) {
+	playfield_mask(cache->pf_mask.w, tia->regs[PF0], tia->regs[PF1], tia->regs[PF2],
+			tia->regs[CTRLPF]);
+	cache->pf_dirty = 0;
 }
 
-/* 
- * insert hblank at end of a scanline
- * decide when to place pixels
- * call update at the end of a frame
- * reset line_i and scanline_i at the end of a frame
+
+/*
+ * Compositing
+ *
+ * Every pixel gets a mask of the objects present on it. The mask alone
+ * decides the pixel: priority_lut gives the object whose color shows, for
+ * either setting of the CTRLPF priority bit, and collision_lut gives the
+ * collisions it causes. Collisions are not worked out as pixels are drawn,
+ * the masks seen are only collected in a set, and turned into collision
+ * bits when the CPU reads a collision register.
+ *
+ * The mask only changes where an object starts or ends, so the scanline is
+ * not composed a pixel at a time. The edges of all the object masks are
+ * found 64 pixels at a time, and each run between two edges is looked up
+ * once and filled in one go.
  */
 
-/* responsible for boundary matching and handling ti*/
+/* Where the color of a pixel comes from */
+enum color_source {
+	SRC_BK,
+	SRC_PF,
+	SRC_BL,
+	SRC_P0,
+	SRC_P1,
+	NSOURCES
+};
+
+static byte_t priority_lut[2][64];
+
+/* Bits 2n and 2n+1 are D6 and D7 of collision register n */
+static uint16_t collision_lut[64];
 
-void tia_exec() {
-	if (isonscreen()) {
-		place_pixel();
-		if (cti == VISIBLE_HEIGHT * VISIBLE_WIDTH - 1) {
-			display();
+#define cx_bit(reg, d) (1 << (2 * (reg) + (d) - 6))
+
+static void init_compositor() {
+	for (int m = 0; m < 64; ++m) {
+		/* Players and missiles above the ball, and the ball above the playfield */
+		byte_t normal = SRC_BK;
+		if (m & (MASK_P0 | MASK_M0)) {
+			normal = SRC_P0;
+		}
+		else if (m & (MASK_P1 | MASK_M1)) {
+			normal = SRC_P1;
 		}
+		else if (m & MASK_BL) {
+			normal = SRC_BL;
+		}
+		else if (m & MASK_PF) {
+			normal = SRC_PF;
+		}
+		/* Ball and playfield above the players and missiles */
+		byte_t above = normal;
+		if (m & MASK_BL) {
+			above = SRC_BL;
+		}
+		else if (m & MASK_PF) {
+			above = SRC_PF;
+		}
+		priority_lut[0][m] = normal;
+		priority_lut[1][m] = above;
 	}
-	hi++;
-	if (hi > TOTAL_WIDTH) {
-		hi = 0;
-		vi++;
+
+	static const struct {
+		byte_t a;
+		byte_t b;
+		uint16_t bit;
+	} pairs[] = {
+		{ MASK_M0, MASK_P1, cx_bit(CXM0P, 7) },
+		{ MASK_M0, MASK_P0, cx_bit(CXM0P, 6) },
+		{ MASK_M1, MASK_P0, cx_bit(CXM1P, 7) },
+		{ MASK_M1, MASK_P1, cx_bit(CXM1P, 6) },
+		{ MASK_P0, MASK_PF, cx_bit(CXP0FB, 7) },
+		{ MASK_P0, MASK_BL, cx_bit(CXP0FB, 6) },
+		{ MASK_P1, MASK_PF, cx_bit(CXP1FB, 7) },
+		{ MASK_P1, MASK_BL, cx_bit(CXP1FB, 6) },
+		{ MASK_M0, MASK_PF, cx_bit(CXM0FB, 7) },
+		{ MASK_M0, MASK_BL, cx_bit(CXM0FB, 6) },
+		{ MASK_M1, MASK_PF, cx_bit(CXM1FB, 7) },
+		{ MASK_M1, MASK_BL, cx_bit(CXM1FB, 6) },
+		{ MASK_BL, MASK_PF, cx_bit(CXBLPF, 7) },
+		{ MASK_P0, MASK_P1, cx_bit(CXPPMM, 7) },
+		{ MASK_M0, MASK_M1, cx_bit(CXPPMM, 6) }
+	};
+	for (int m = 0; m < 64; ++m) {
+		collision_lut[m] = 0;
+		for (unsigned int i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i) {
+			if ((m & pairs[i].a) && (m & pairs[i].b)) {
+				collision_lut[m] |= pairs[i].bit;
+			}
+		}
 	}
-	if (vi > TOTAL_HEIGHT) {
-		vi = 0;
+}
+
+/* Fold the masks seen since the last time into the collision registers */
+static void latch_collisions(tia_t *tia) {
+	while (tia->masks_seen) {
+		int m = __builtin_ctzll(tia->masks_seen);
+		tia->collisions |= collision_lut[m];
+		tia->masks_seen &= tia->masks_seen - 1;
 	}
-	ti = cal_total_index(hi, vi);
+}
 
+static void fill_span(byte_t *row, unsigned int x0, unsigned int x1, byte_t color) {
+	memset(row + x0, color, x1 - x0);
 }
 
-static SDL_Window *gbl_window;
-static SDL_Renderer *gbl_renderer;
-static SDL_Texture *gbl_texture;
+/* Bit x is set if pixel x has other objects on it than pixel x - 1. Pixel
+ * 0, and the first pixel of the right half, always start a run */
+static void find_edges(const tia_cache_t *cache, uint64_t edges[3]) {
+	for (int w = 0; w < 3; ++w) {
+		uint64_t e = 0;
+		uint64_t v = cache->pf_mask.w[w];
+		uint64_t carry = w ? cache->pf_mask.w[w - 1] >> 63 : 0;
+		e |= v ^ ((v << 1) | carry);
+		for (int i = 0; i < NOBJECTS; ++i) {
+			v = cache->obj_mask[i].w[w];
+			carry = w ? cache->obj_mask[i].w[w - 1] >> 63 : 0;
+			e |= v ^ ((v << 1) | carry);
+		}
+		edges[w] = e;
+	}
+	edges[0] |= 1;
+	edges[(VISIBLE_WIDTH / 2) >> 6] |= (uint64_t)1 << ((VISIBLE_WIDTH / 2) & 63);
+}
 
-void tia_init() {
-	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
-	int rv = 0;
-	rv = SDL_CreateWindowAndRenderer(VISIBLE_WIDTH, VISIBLE_HEIGHT,
-			SDL_WINDOW_RESIZABLE, &gbl_window, &gbl_renderer);
-	if (rv != 0) {
-		log_fatal("SDL_CreateWindowAndRenderer(): %s", SDL_GetError());
-		goto exit;
+/* The first edge after pixel x, or end if there is none before it */
+static unsigned int next_edge(const uint64_t edges[3], unsigned int x, unsigned int end) {
+	for (++x; x < end; x = (x | 63) + 1) {
+		uint64_t e = edges[x >> 6] >> (x & 63);
+		if (e) {
+			x += __builtin_ctzll(e);
+			return x < end ? x : end;
+		}
 	}
-	SDL_SetRenderDrawColor(gbl_renderer, 0x00, 0x00, 0x00, 0xff);
-	SDL_RenderClear(gbl_renderer);
-	gbl_texture = SDL_CreateTexture(gbl_renderer, SDL_PIXELFORMAT_RGBA8888, 
-			SDL_TEXTUREACCESS_STREAMING, VISIBLE_WIDTH, VISIBLE_HEIGHT);
-	if (!gbl_texture) {
-		log_fatal("SDL_CreateTexture(): %s", SDL_GetError());
-		goto exit;
+	return end;
+}
+
+static byte_t mask_at(const tia_cache_t *cache, unsigned int x) {
+	static const byte_t object_bit[NOBJECTS] = { MASK_P0, MASK_P1, MASK_M0, MASK_M1, MASK_BL };
+	byte_t m = sprite_test(&cache->pf_mask, x) ? MASK_PF : 0;
+	for (int i = 0; i < NOBJECTS; ++i) {
+		if (sprite_test(&cache->obj_mask[i], x)) {
+			m |= object_bit[i];
+		}
 	}
-	int scale = 8;
-	SDL_SetWindowSize(gbl_window, VISIBLE_WIDTH * scale, VISIBLE_HEIGHT * scale);
+	return m;
+}
 
-	init_color_map();
+static void compose(tia_t *tia, tia_cache_t *cache, byte_t *row, unsigned int x0, unsigned int x1) {
+	/* Colors of the sources on the left and the right half. Score mode
+	 * colors each half of the playfield like the player on it */
+	byte_t palette[2][NSOURCES];
+	for (int half = 0; half < 2; ++half) {
+		palette[half][SRC_BK] = color_of(COLUBK);
+		palette[half][SRC_PF] = color_of(COLUPF);
+		palette[half][SRC_BL] = color_of(COLUPF);
+		palette[half][SRC_P0] = color_of(COLUP0);
+		palette[half][SRC_P1] = color_of(COLUP1);
+		if (tia->regs[CTRLPF] & 0x02) {
+			palette[half][SRC_PF] = color_of(COLUP0 + half);
+		}
+	}
+	const byte_t *priority = priority_lut[(tia->regs[CTRLPF] >> 2) & 0x01];
+
+	uint64_t edges[3];
+	find_edges(cache, edges);
+	uint64_t seen = 0;
+	for (unsigned int x = x0; x < x1; ) {
+		unsigned int end = next_edge(edges, x, x1);
+		byte_t m = mask_at(cache, x);
+		seen |= (uint64_t)1 << m;
+		fill_span(row, x, end, palette[x >= VISIBLE_WIDTH / 2][priority[m]]);
+		x = end;
+	}
+	tia->masks_seen |= seen;
+}
+
+/* Draw the pixels for color clocks h0 to h1 of the current scanline */
+static void draw(emu_t *emu, unsigned int h0, unsigned int h1) {
+	tia_t *tia = &emu->machine.tia;
+	tia_cache_t *cache = &emu->tia_cache;
+	if (h1 <= HBLANK_W) {
+		return;
+	}
+	if (h0 < HBLANK_W) {
+		h0 = HBLANK_W;
+	}
+	/* Lines outside the frame buffer are still composed, for collisions */
+	byte_t offscreen[VISIBLE_WIDTH];
+	byte_t *row = offscreen;
+	if (tia->vi >= FIRST_VISIBLE_LINE && tia->vi < FIRST_VISIBLE_LINE + VISIBLE_HEIGHT) {
+		row = cache->frame_buffer + cal_total_cindex(0, tia->vi - FIRST_VISIBLE_LINE);
+	}
+	unsigned int x0 = h0 - HBLANK_W;
+	unsigned int x1 = h1 - HBLANK_W;
+	if (is_vsync_on(tia) || is_vblank_on(tia)) {
+		fill_span(row, x0, x1, 0x00);
+		return;
+	}
 
-	log_trace("TIA Init Success");
-	return;
+	if (cache->pf_dirty) {
+		update_playfield(tia, cache);
+	}
+	if (cache->obj_dirty) {
+		update_objects(tia, cache);
+	}
+	compose(tia, cache, row, x0, x1);
 
-exit:
-	exit(EXIT_FAILURE);
+	if (tia->hmove_blank && x0 < HMOVE_BLANK_W) {
+		fill_span(row, x0, x1 < HMOVE_BLANK_W ? x1 : HMOVE_BLANK_W, 0x00);
+	}
 }
 
-void tia_free() {
-	SDL_Quit();
-	log_trace("%s", "Freed TIA");
+/* Start drawing a new frame from the top */
+static void new_frame(tia_t *tia) {
+	tia->vi = 0;
+	tia->frame_done = 1;
 }
 
-void display() {
-	SDL_UpdateTexture(gbl_texture, NULL, frame_buffer, VISIBLE_WIDTH * sizeof(pixel_t));
-	SDL_RenderClear(gbl_renderer);
-	SDL_RenderCopy(gbl_renderer, gbl_texture, NULL, NULL);
-	SDL_RenderPresent(gbl_renderer);
+/* Run the TIA for a number of color clocks, a scanline at a time */
+static void tia_advance(emu_t *emu, cycles_t clocks) {
+	tia_t *tia = &emu->machine.tia;
+	while (clocks > 0) {
+		unsigned int n = TOTAL_WIDTH - tia->hi;
+		if (clocks < n) {
+			n = clocks;
+		}
+		draw(emu, tia->hi, tia->hi + n);
+		tia->hi += n;
+		clocks -= n;
+		if (tia->hi == TOTAL_WIDTH) {
+			tia->hi = 0;
+			tia->vi++;
+			tia->hmove_blank = 0;
+			if (tia->vi >= MAX_HEIGHT) {
+				new_frame(tia);
+			}
+		}
+	}
 }
 
-static SDL_Event gbl_event;
-#define iskey(e, code) (e.key.keysym.scancode == code)
+void tia_sync(emu_t *emu) {
+	tia_t *tia = &emu->machine.tia;
+	cycles_t now = fetch_machine_cycles(emu) * 3;
+	cycles_t clocks = now - tia->tia_clock;
+	tia->tia_clock = now;
+	cnt_color_clocks(emu, clocks);
+	tia_advance(emu, clocks);
+}
 
-static void process_input(int code) {
-	switch (code) {
-		case SDL_SCANCODE_Q:
-		case SDL_SCANCODE_ESCAPE:
-			exit(EXIT_SUCCESS);
+void tia_write(emu_t *emu, addr_t addr, byte_t b) {
+	tia_t *tia = &emu->machine.tia;
+	tia_cache_t *cache = &emu->tia_cache;
+	tia_sync(emu);
+	byte_t reg = addr & 0x3f;
+	byte_t old = tia->regs[reg];
+	tia->regs[reg] = b;
+	switch (reg) {
+		case VSYNC:
+			if ((b & 0x02) && !(old & 0x02)) {
+				new_frame(tia);
+				cpu_yield(emu);
+			}
+			break;
+		case WSYNC:
+			/* Round up, the CPU can only resume on a machine cycle */
+			cnt_machine_cycles(emu, (TOTAL_WIDTH - tia->hi + 2) / 3);
+			break;
+		case CTRLPF:
+			/* The ball size is in CTRLPF as well */
+			cache->pf_dirty = 1;
+			cache->obj_dirty = 1;
+			break;
+		case PF0:
+		case PF1:
+		case PF2:
+			cache->pf_dirty = 1;
+			break;
+		case NUSIZ0:
+		case NUSIZ1:
+		case REFP0:
+		case REFP1:
+		case VDELP0:
+		case VDELP1:
+		case VDELBL:
+		case ENAM0:
+		case ENAM1:
+		case ENABL:
+			cache->obj_dirty = 1;
+			break;
+		case GRP0:
+			tia->grp_old[1] = tia->regs[GRP1];
+			cache->obj_dirty = 1;
 			break;
-		case SDL_SCANCODE_W:
-		case SDL_SCANCODE_A:
-		case SDL_SCANCODE_S:
-		case SDL_SCANCODE_D:
-		case SDL_SCANCODE_LEFT:
-		case SDL_SCANCODE_RIGHT:
-		case SDL_SCANCODE_UP:
-		case SDL_SCANCODE_DOWN:
-			pia_process_input(code);
+		case GRP1:
+			tia->grp_old[0] = tia->regs[GRP0];
+			tia->enabl_old = tia->regs[ENABL];
+			cache->obj_dirty = 1;
 			break;
-		default:
+		case RESP0:
+		case RESP1:
+			tia->pos[reg - RESP0] = reset_position(tia, 5);
+			cache->obj_dirty = 1;
+			break;
+		case RESM0:
+		case RESM1:
+		case RESBL:
+			tia->pos[reg - RESP0] = reset_position(tia, 4);
+			cache->obj_dirty = 1;
+			break;
+		case RESMP0:
+		case RESMP1:
+			if ((old & 0x02) && !(b & 0x02)) {
+				unlock_missile(tia, reg - RESMP0);
+			}
+			cache->obj_dirty = 1;
+			break;
+		case HMOVE:
+			hmove(tia);
+			cache->obj_dirty = 1;
+			break;
+		case CXCLR:
+			tia->collisions = 0;
+			tia->masks_seen = 0;
+			break;
+		case HMCLR:
+			for (int i = HMP0; i <= HMBL; ++i) {
+				tia->regs[i] = 0;
+			}
 			break;
 	}
 }
 
-void handle_input() {
-	while (SDL_PollEvent(&gbl_event) != 0) {
-			if (gbl_event.type == SDL_QUIT) {
-				exit(EXIT_SUCCESS);
-			}
-			else {
-				process_input(gbl_event.key.keysym.scancode);
-			}
+byte_t tia_read(emu_t *emu, addr_t addr) {
+	tia_t *tia = &emu->machine.tia;
+	tia_sync(emu);
+	byte_t reg = addr & 0x0f;
+	if (reg <= CXPPMM) {
+		latch_collisions(tia);
+		return ((tia->collisions >> (2 * reg)) & 0x03) << 6;
+	}
+	/* Fire buttons read D7 clear while pressed */
+	if (reg == INPT4 || reg == INPT5) {
+		return (tia->fire >> (reg - INPT4)) & 1 ? 0x00 : 0x80;
 	}
+	return 0x00;
+}
+
+void tia_set_fire(emu_t *emu, byte_t pressed) {
+	emu->machine.tia.fire = pressed & 0x03;
+}
+
+cycles_t tia_frame_budget(emu_t *emu) {
+	const tia_t *tia = &emu->machine.tia;
+	return ((MAX_HEIGHT - tia->vi) * TOTAL_WIDTH - tia->hi + 2) / 3;
+}
+
+_Bool tia_frame_done(emu_t *emu) {
+	tia_t *tia = &emu->machine.tia;
+	_Bool done = tia->frame_done;
+	tia->frame_done = 0;
+	return done;
+}
+
+/*
+ * Video Backends
+ *
+ * What happens to a finished frame, and where input comes from, is up to
+ * the backend given to tia_init(). The null backend does nothing at all,
+ * which is all that is needed to run without a display.
+ */
+
+static void null_init() {}
+static void null_free() {}
+static void null_present(emu_t *emu) {}
+static void null_poll(emu_t *emu) {}
+
+const video_backend_t null_backend = {
+	"null",
+	null_init,
+	null_free,
+	null_present,
+	null_poll
+};
+
+/* The tables shared by all consoles */
+void tia_tables_init() {
+	init_color_map();
+	palette_init(color_map);
+	playfield_init();
+	sprite_init();
+	init_compositor();
+}
+
+void tia_init(emu_t *emu, const video_backend_t *b) {
+	tia_cache_t *cache = &emu->tia_cache;
+	memset(&emu->machine.tia, 0, sizeof(tia_t));
+	cache->frame_buffer = calloc(VISIBLE_HEIGHT * VISIBLE_WIDTH, 1);
+	if (!cache->frame_buffer) {
+		log_fatal("tia_init(): Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	tia_invalidate(emu);
+	cache->backend = b;
+	cache->backend->init();
+	log_trace("TIA Init Success, %s video", cache->backend->name);
+}
+
+void tia_invalidate(emu_t *emu) {
+	emu->tia_cache.pf_dirty = 1;
+	emu->tia_cache.obj_dirty = 1;
+}
+
+void tia_free(emu_t *emu) {
+	emu->tia_cache.backend->free();
+	free(emu->tia_cache.frame_buffer);
+	log_trace("%s", "Freed TIA");
+}
+
+const byte_t *tia_frame(emu_t *emu) {
+	return emu->tia_cache.frame_buffer;
+}
+
+void tia_convert_frame(emu_t *emu, void *dst, int pitch, enum pixel_format fmt) {
+	palette_convert(dst, pitch, emu->tia_cache.frame_buffer, VISIBLE_WIDTH, VISIBLE_HEIGHT, fmt);
+}
+
+void display(emu_t *emu) {
+	emu->tia_cache.backend->present(emu);
+}
+
+void handle_input(emu_t *emu) {
+	emu->tia_cache.backend->poll(emu);
 }
@@ -2,6 +2,8 @@
 #define TIA_H
 
 #include "mspace.h"
+#include "palette.h"
+#include "sprite.h"
 
 typedef uint32_t pixel_t;
 
@@ -10,24 +12,119 @@ typedef uint32_t pixel_t;
 #define VBLANK_H 37
 #define VOVERSCAN_H 30
 #define TOTAL_HEIGHT 262 			// vsync + vblank + vheight + overscan
+#define MAX_HEIGHT 320				// give up waiting for vsync after this many lines
 
 #define VISIBLE_WIDTH 160			
 #define HBLANK_W 68				// HORIZANTAL BLANK
 #define TOTAL_WIDTH 228 				// VISIBLE_WIDTH + HORZ_BLANK
 
 
-int is_strobe(addr_t reg);
-void strobe_dispatch(addr_t reg, byte_t b);
+/* Presents finished frames, and gathers input */
+typedef struct video_backend_t {
+	const char *name;
+	void (*init)();
+	void (*free)();
+	/* Present the frame just finished, see tia_convert_frame() */
+	void (*present)(emu_t *emu);
+	/* Poll for input, once a frame */
+	void (*poll)(emu_t *emu);
+} video_backend_t;
 
-void tia_init();
-void tia_exec();
-void tia_free();
+/* Does nothing, for running without a display */
+extern const video_backend_t null_backend;
 
-void cnt_color_clocks(cycles_t inc);
-cycles_t fetch_color_clocks();
+/* The movable objects */
+enum tia_object {
+	OBJ_P0,
+	OBJ_P1,
+	OBJ_M0,
+	OBJ_M1,
+	OBJ_BL,
+	NOBJECTS
+};
 
-void display();
+/* The TIA's part of the machine state */
+typedef struct tia_t {
+	/* TIA registers, as last written by the CPU */
+	byte_t regs[0x40];
+	cycles_t color_clocks;
+	/* The color clock the TIA has been synced up to */
+	cycles_t tia_clock;
+	/* Bit m is set if a pixel with the object mask m was drawn */
+	uint64_t masks_seen;
 
-void handle_input();
+	/* Pointers
+	 * hi - horizontal index, the color clock within the scanline
+	 * vi - vertical index, the scanline counted from the start of vertical sync
+	 */
+	uint16_t vi;
+	byte_t hi;
+
+	/* Object positions, in pixels from the left edge of the scanline */
+	byte_t pos[NOBJECTS];
+	/* Vertical delay: writing GRP1 saves GRP0 and ENABL, writing GRP0 saves
+	 * GRP1. VDELxx draws the saved value instead of the register */
+	byte_t grp_old[2];
+	byte_t enabl_old;
+	_Bool hmove_blank;
+
+	uint16_t collisions;
+	_Bool frame_done;
+	/* Fire buttons held, bit 0 for P0 (INPT4) and bit 1 for P1 (INPT5) */
+	byte_t fire;
+} tia_t;
+
+/* What the TIA draws with. The masks are worked out from tia_t whenever
+ * they are dirty, the frame is only ever written
+ */
+typedef struct tia_cache_t {
+	/* The objects, as laid out on the scanline by the sprite tables. A
+	 * disabled object has an empty mask */
+	sprite_mask_t obj_mask[NOBJECTS];
+	/* The playfield, laid out like the objects */
+	sprite_mask_t pf_mask;
+	_Bool obj_dirty;
+	_Bool pf_dirty;
+	/* The frame, as color indices. It is converted to pixels once complete */
+	byte_t *frame_buffer;
+	const video_backend_t *backend;
+} tia_cache_t;
+
+/* Build the tables shared by all consoles, once, before any tia_init() */
+void tia_tables_init();
+void tia_init(emu_t *emu, const video_backend_t *backend);
+void tia_free(emu_t *emu);
+/* Have the masks rebuilt before the next pixel is drawn */
+void tia_invalidate(emu_t *emu);
+
+/* Run the TIA up to the current machine cycle */
+void tia_sync(emu_t *emu);
+/* Read a TIA register, syncing the TIA first */
+byte_t tia_read(emu_t *emu, addr_t addr);
+/* Write to a TIA register, syncing the TIA first */
+void tia_write(emu_t *emu, addr_t addr, byte_t b);
+/* Hold the fire buttons set in pressed, bit 0 for P0 and bit 1 for P1, and
+ * release the others
+ */
+void tia_set_fire(emu_t *emu, byte_t pressed);
+/* Number of machine cycles until the TIA ends the frame on its own */
+cycles_t tia_frame_budget(emu_t *emu);
+
+/* Returns 1, once, after a frame has been completed */
+_Bool tia_frame_done(emu_t *emu);
+
+void cnt_color_clocks(emu_t *emu, cycles_t inc);
+cycles_t fetch_color_clocks(emu_t *emu);
+
+/* The last frame drawn, VISIBLE_WIDTH x VISIBLE_HEIGHT color indices */
+const byte_t *tia_frame(emu_t *emu);
+/* Convert the last frame drawn to pixels in fmt, pitch bytes per row */
+void tia_convert_frame(emu_t *emu, void *dst, int pitch, enum pixel_format fmt);
+
+/* Hand the finished frame to the backend */
+void display(emu_t *emu);
+
+/* Have the backend poll for input */
+void handle_input(emu_t *emu);
 
 #endif